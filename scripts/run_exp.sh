@@ -10,14 +10,12 @@ TIME=$(date +"%H-%M")
 RES_FILE="${RESULT_DIR}/N_${N}_${DATE}_${TIME}.csv"
 echo "Writing results to: ${RES_FILE}"
 workloads=$(ls -v workloads/${N}_*)
-trees=("../build/simple" "../build/tail" "../build/lil" "../build/lol" "../build/lol_v" "../build/lol_vr" "../build/quit")
+# strategies are selected with the TREES knob in config.toml; RESULTS_FILE is overridden so that the results are
+# written to stdout
+tree="../build/tree_analysis"
 
-for tree in ${trees[@]}; do
-    echo "Running $tree"
-    for input in $workloads; do
-        for ((i = 1; i <= $TRIALS; i++)); do
-             $tree $RES_FILE $input
-        done
-        #echo "Running $tree"
+for input in $workloads; do
+    for ((i = 1; i <= $TRIALS; i++)); do
+         RESULTS_FILE=- $tree $input >> "$RES_FILE"
     done
 done
@@ -0,0 +1,146 @@
+#ifndef ADAPTIVE_CONTROLLER_H
+#define ADAPTIVE_CONTROLLER_H
+
+#include <algorithm>
+#include <cstdint>
+
+#include "insert_policy.h"
+
+/**
+ * Online controller for adaptive_policy. It watches the inserts in windows of WINDOW keys and decides
+ * which strategy the tree should use, where leaves should split and how many fast path misses QuIT tolerates before
+ * a hard reset.
+ *
+ * - sortedness: fraction of keys that are not smaller than the previous key; it does not depend on the current
+ *   strategy, so it is measured even when the fast path is off
+ * - fast path hit rate: ctr_fp delta over the window; a fast path that keeps missing is only overhead, so the
+ *   controller falls back to the textbook tree for COOLDOWN windows
+ * - reset frequency: ctr_hard delta over the window; frequent resets while the fast path still hits mean the
+ *   threshold is too eager, rare resets while it misses mean it is too lazy
+ */
+template<typename key_type>
+class adaptive_controller {
+public:
+    static constexpr uint32_t WINDOW = 1 << 14;
+    static constexpr double TAIL_SORTEDNESS = .999;
+    static constexpr double QUIT_SORTEDNESS = .75;
+    static constexpr double LIL_SORTEDNESS = .6;
+    static constexpr double MIN_FP_RATE = .1;
+    static constexpr double GOOD_FP_RATE = .5;
+    static constexpr uint8_t PATIENCE = 2;  // windows that must agree before switching
+    static constexpr uint8_t COOLDOWN = 8;  // windows without fast path after a demotion
+    static constexpr double SORTED_SPLIT_FILL = .9;
+    static constexpr double DEFAULT_SPLIT_FILL = .5;
+
+private:
+    const uint16_t leaf_capacity;
+    const uint8_t min_threshold;
+    const uint8_t max_threshold;
+
+    strategy_mode mode;
+    strategy_mode proposed;
+    uint8_t votes;
+    uint8_t cooldown;
+    uint8_t threshold;
+
+    key_type last_key;
+    uint32_t ops;
+    uint32_t in_order;
+    uint32_t last_fp;
+    uint32_t last_hard;
+
+    static strategy_mode propose(double sortedness) {
+        if (sortedness >= TAIL_SORTEDNESS) return strategy_mode::TAIL;
+        if (sortedness >= QUIT_SORTEDNESS) return strategy_mode::QUIT;
+        if (sortedness >= LIL_SORTEDNESS) return strategy_mode::LIL;
+        return strategy_mode::SIMPLE;
+    }
+
+public:
+    adaptive_controller(uint16_t leaf_capacity, uint8_t threshold) :
+            leaf_capacity(leaf_capacity),
+            min_threshold(2),
+            max_threshold(std::min(4 * threshold, 255)),
+            mode(strategy_mode::QUIT),
+            proposed(strategy_mode::QUIT),
+            votes(0),
+            cooldown(0),
+            threshold(threshold),
+            last_key(),
+            ops(0),
+            in_order(0),
+            last_fp(0),
+            last_hard(0) {}
+
+    /**
+     * Record an insert
+     * @param key
+     * @return true when the window is complete and end_window should be called
+     */
+    bool observe(const key_type &key) {
+        in_order += last_key <= key;
+        last_key = key;
+        return ++ops == WINDOW;
+    }
+
+    /**
+     * Close the current window and update the decisions
+     * @param ctr_fp fast path inserts so far
+     * @param ctr_hard hard resets so far
+     */
+    void end_window(uint32_t ctr_fp, uint32_t ctr_hard) {
+        double sortedness = static_cast<double>(in_order) / ops;
+        double fp_rate = static_cast<double>(ctr_fp - last_fp) / ops;
+        uint32_t resets = ctr_hard - last_hard;
+
+        if (mode != strategy_mode::SIMPLE && fp_rate < MIN_FP_RATE) {
+            // demotion is immediate
+            mode = proposed = strategy_mode::SIMPLE;
+            votes = 0;
+            cooldown = COOLDOWN;
+        } else if (cooldown) {
+            --cooldown;
+        } else {
+            strategy_mode next = propose(sortedness);
+            if (next == mode) {
+                votes = 0;
+            } else if (next == proposed) {
+                if (++votes >= PATIENCE) {
+                    mode = next;
+                    votes = 0;
+                }
+            } else {
+                proposed = next;
+                votes = 1;
+            }
+        }
+
+        if (mode == strategy_mode::QUIT) {
+            if (resets > 0 && fp_rate >= GOOD_FP_RATE) {
+                threshold = std::min<unsigned>(threshold * 2, max_threshold);
+            } else if (resets == 0 && fp_rate < GOOD_FP_RATE) {
+                threshold = std::max<unsigned>(threshold / 2, min_threshold);
+            }
+        }
+
+        ops = 0;
+        in_order = 0;
+        last_fp = ctr_fp;
+        last_hard = ctr_hard;
+    }
+
+    [[nodiscard]] strategy_mode current_mode() const { return mode; }
+
+    [[nodiscard]] uint8_t reset_threshold() const { return threshold; }
+
+    /**
+     * @param appended whether the leaf is the tail or the fast path leaf, the only ones the sorted keys reach
+     * @return how many elements should stay on the left side after a leaf split
+     */
+    [[nodiscard]] uint16_t split_leaf_pos(bool appended) const {
+        double fill = mode == strategy_mode::TAIL && appended ? SORTED_SPLIT_FILL : DEFAULT_SPLIT_FILL;
+        return std::max<uint16_t>(1, (leaf_capacity + 1) * fill);
+    }
+};
+
+#endif
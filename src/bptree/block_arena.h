@@ -0,0 +1,134 @@
+#ifndef BLOCK_ARENA_H
+#define BLOCK_ARENA_H
+
+#include <cstdint>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#ifndef BLOCK_SIZE_BYTES
+#define BLOCK_SIZE_BYTES 4096
+#endif
+
+struct Block {
+    uint8_t block_buf[BLOCK_SIZE_BYTES]{};
+};
+
+/**
+ * Placement of the arena memory
+ * - huge_pages: "none" for 4 KB pages, "thp" to ask for transparent huge pages, "2mb" or "1gb" for pages of the
+ *   hugetlbfs pool, which falls back to "thp" when the pool is too small
+ * - numa: "first_touch" to place every page on the node of the thread that touches it first, "interleave" to spread
+ *   the pages round-robin over all the online nodes
+ */
+struct arena_config {
+    std::string huge_pages = "thp";
+    std::string numa = "first_touch";
+};
+
+/**
+ * Memory for the blocks of a block manager. The whole range is reserved up front but pages are only committed when
+ * first touched, so creating a large arena is instant and costs no memory until the tree grows into it. Untouched
+ * memory reads as zeros.
+ */
+class block_arena {
+    static constexpr size_t HUGE_2MB = 2 << 20;
+    static constexpr size_t HUGE_1GB = 1 << 30;
+
+    void *mapping;
+    size_t mapped;
+    char *base;
+
+    static size_t round_up(size_t bytes, size_t unit) { return (bytes + unit - 1) / unit * unit; }
+
+    /**
+     * @return false when the pool cannot hold the mapping
+     */
+    bool map_hugetlb(size_t bytes, size_t page) {
+#if defined(MAP_HUGETLB) && defined(MAP_HUGE_SHIFT)
+        const int log_page = page == HUGE_1GB ? 30 : 21;
+        mapped = round_up(bytes, page);
+        // no MAP_NORESERVE: the pool pages are reserved now, so a short pool fails here instead of at the first touch
+        mapping = mmap(nullptr, mapped, PROT_READ | PROT_WRITE,
+                       MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB | (log_page << MAP_HUGE_SHIFT), -1, 0);
+        if (mapping != MAP_FAILED) {
+            base = static_cast<char *>(mapping);
+            return true;
+        }
+#endif
+        mapping = nullptr;
+        return false;
+    }
+
+    void map_pages(size_t bytes, bool transparent_huge_pages) {
+        // over-reserve to align the start on a huge page, so that every 2 MB of blocks can be backed by one page
+        mapped = round_up(bytes, HUGE_2MB) + HUGE_2MB;
+        mapping = mmap(nullptr, mapped, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+        if (mapping == MAP_FAILED) {
+            std::cerr << "Error: could not reserve " << bytes << " bytes" << std::endl;
+            std::abort();
+        }
+        base = reinterpret_cast<char *>(round_up(reinterpret_cast<uintptr_t>(mapping), HUGE_2MB));
+#ifdef MADV_HUGEPAGE
+        if (transparent_huge_pages) madvise(base, round_up(bytes, HUGE_2MB), MADV_HUGEPAGE);
+#endif
+    }
+
+    /**
+     * Interleave the pages over the online nodes; mbind is called directly to avoid a dependency on libnuma
+     */
+    void interleave(size_t bytes) {
+#ifdef SYS_mbind
+        constexpr int MPOL_INTERLEAVE = 3;
+        unsigned long nodes = 0;
+        std::ifstream online("/sys/devices/system/node/online");
+        // a list of ranges such as 0-1,4
+        for (std::string range; std::getline(online, range, ',');) {
+            size_t dash = range.find('-');
+            unsigned first = std::stoul(range);
+            unsigned last = dash == std::string::npos ? first : std::stoul(range.substr(dash + 1));
+            for (unsigned node = first; node <= last && node < 64; ++node) nodes |= 1ul << node;
+        }
+        if (nodes == 0) return;
+        if (syscall(SYS_mbind, base, round_up(bytes, HUGE_2MB), MPOL_INTERLEAVE, &nodes, 64, 0) != 0) {
+            std::cerr << "Warning: could not interleave the arena over NUMA nodes" << std::endl;
+        }
+#endif
+    }
+
+public:
+    /**
+     * @param bytes size of the arena
+     * @param config page size and NUMA placement
+     */
+    explicit block_arena(size_t bytes, const arena_config &config = {}) : mapping(nullptr), mapped(0), base(nullptr) {
+        if (config.huge_pages == "2mb" || config.huge_pages == "1gb") {
+            if (!map_hugetlb(bytes, config.huge_pages == "1gb" ? HUGE_1GB : HUGE_2MB)) {
+                std::cerr << "Warning: hugetlbfs pool too small for " << bytes << " bytes, using THP" << std::endl;
+            }
+        } else if (config.huge_pages != "thp" && config.huge_pages != "none") {
+            std::cerr << "Invalid huge page setting: " << config.huge_pages << std::endl;
+        }
+        if (mapping == nullptr) map_pages(bytes, config.huge_pages != "none");
+
+        if (config.numa == "interleave") {
+            interleave(bytes);
+        } else if (config.numa != "first_touch") {
+            std::cerr << "Invalid NUMA policy: " << config.numa << std::endl;
+        }
+    }
+
+    block_arena(const block_arena &) = delete;
+
+    block_arena &operator=(const block_arena &) = delete;
+
+    ~block_arena() { munmap(mapping, mapped); }
+
+    [[nodiscard]] void *data() const { return base; }
+};
+
+#endif
@@ -0,0 +1,103 @@
+#ifndef BLOCK_CODEC_H
+#define BLOCK_CODEC_H
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+
+/**
+ * Delta + bitpack compression of a block seen as 32-bit words. The words are cut in frames of FRAME words; a frame
+ * stores its first word as is, then the zigzag deltas between consecutive words packed at the width of the largest
+ * one. Sorted keys, dense child ids and repeated values all turn into small deltas, so node blocks shrink several
+ * times, while a frame of noise costs one byte more than raw.
+ */
+namespace block_codec {
+    static constexpr uint32_t FRAME = 128;
+
+    // decompress reads whole 64-bit words, up to 7 bytes past the compressed data
+    static constexpr size_t PADDING = sizeof(uint64_t);
+
+    /**
+     * @return bytes to reserve for the compressed form of a block of words words, padding included
+     */
+    constexpr size_t bound(size_t words) {
+        return words * sizeof(uint32_t) + (words + FRAME - 1) / FRAME + PADDING;
+    }
+
+    inline uint32_t zigzag(uint32_t delta) { return (delta << 1) ^ -(delta >> 31); }
+
+    inline uint32_t unzigzag(uint32_t v) { return (v >> 1) ^ -(v & 1); }
+
+    /**
+     * @param in block of words 32-bit words
+     * @param words
+     * @param out at least bound(words) bytes
+     * @return compressed size in bytes
+     */
+    inline size_t compress(const uint8_t *in, size_t words, uint8_t *out) {
+        uint8_t *p = out;
+        for (size_t first = 0; first < words; first += FRAME) {
+            const size_t n = std::min<size_t>(FRAME, words - first);
+            uint32_t w[FRAME];
+            std::memcpy(w, in + first * sizeof(uint32_t), n * sizeof(uint32_t));
+            uint32_t any = 0;
+            for (size_t i = n - 1; i > 0; --i) {
+                w[i] = zigzag(w[i] - w[i - 1]);
+                any |= w[i];
+            }
+            const uint8_t width = any ? 32 - __builtin_clz(any) : 0;
+            *p++ = width;
+            std::memcpy(p, w, sizeof(uint32_t));
+            p += sizeof(uint32_t);
+
+            // little-endian bit stream, flushed 32 bits at a time
+            uint64_t bits = 0;
+            unsigned used = 0;
+            for (size_t i = 1; i < n; ++i) {
+                bits |= static_cast<uint64_t>(w[i]) << used;
+                used += width;
+                if (used >= 32) {
+                    const auto low = static_cast<uint32_t>(bits);
+                    std::memcpy(p, &low, sizeof(low));
+                    p += sizeof(low);
+                    bits >>= 32;
+                    used -= 32;
+                }
+            }
+            for (; used > 0; used = used > 8 ? used - 8 : 0) {
+                *p++ = static_cast<uint8_t>(bits);
+                bits >>= 8;
+            }
+        }
+        return p - out;
+    }
+
+    /**
+     * @param in output of compress, followed by PADDING readable bytes
+     * @param words number of words of the block
+     * @param out block of words 32-bit words
+     */
+    inline void decompress(const uint8_t *in, size_t words, uint8_t *out) {
+        const uint8_t *p = in;
+        for (size_t first = 0; first < words; first += FRAME) {
+            const size_t n = std::min<size_t>(FRAME, words - first);
+            const uint8_t width = *p++;
+            const uint64_t mask = (uint64_t(1) << width) - 1;
+            uint32_t w[FRAME];
+            std::memcpy(w, p, sizeof(uint32_t));
+            p += sizeof(uint32_t);
+
+            // a delta starts at most 7 bits into a byte, so one 64-bit load holds all of its 32 bits at most
+            size_t bit = 0;
+            for (size_t i = 1; i < n; ++i, bit += width) {
+                uint64_t bits;
+                std::memcpy(&bits, p + bit / 8, sizeof(bits));
+                w[i] = w[i - 1] + unzigzag(static_cast<uint32_t>((bits >> (bit % 8)) & mask));
+            }
+            p += (bit + 7) / 8;
+            std::memcpy(out + first * sizeof(uint32_t), w, n * sizeof(uint32_t));
+        }
+    }
+}
+
+#endif
@@ -3,22 +3,12 @@
 
 #include <algorithm>
 
+#include "metrics.h"
+
 enum bp_node_type {
     LEAF, INTERNAL
 };
 
-namespace ctr {
-    uint32_t load = 0;
-    uint32_t value_slot = 0;
-    uint32_t value_slot2 = 0;
-    uint32_t child_slot = 0;
-
-    std::ostream &log(std::ostream &os) {
-        os << ", " << load << ", " << value_slot << ", " << value_slot2 << ", " << child_slot;
-        return os;
-    }
-}
-
 template<typename node_id_type, typename key_type, typename value_type>
 class bp_node {
     struct node_info {
@@ -42,7 +32,7 @@ public:
     bp_node() = default;
 
     void load(void *buf) {
-        ++ctr::load;
+        metrics::add(metrics::event::LOAD);
         info = static_cast<node_info *>(buf);
         keys = reinterpret_cast<key_type *>(info + 1);
         if (info->type == LEAF) {
@@ -52,6 +42,35 @@ public:
         }
     }
 
+    /**
+     * Load a block known to hold a leaf, without reading its type
+     */
+    void load_leaf(void *buf) {
+        metrics::add(metrics::event::LOAD);
+        info = static_cast<node_info *>(buf);
+        keys = reinterpret_cast<key_type *>(info + 1);
+        values = reinterpret_cast<value_type *>(keys + leaf_capacity);
+        assert(info->type == LEAF);
+    }
+
+    /**
+     * Load a block known to hold an internal node, without reading its type
+     */
+    void load_internal(void *buf) {
+        metrics::add(metrics::event::LOAD);
+        bind_internal(buf);
+        assert(info->type == INTERNAL);
+    }
+
+    /**
+     * Point at a block that holds, or is about to hold, an internal node, without reading it
+     */
+    void bind_internal(void *buf) {
+        info = static_cast<node_info *>(buf);
+        keys = reinterpret_cast<key_type *>(info + 1);
+        children = reinterpret_cast<node_id_type *>(keys + internal_capacity);
+    }
+
     void init(void *buf, const bp_node_type &type) {
         info = static_cast<node_info *>(buf);
         keys = reinterpret_cast<key_type *>(info + 1);
@@ -80,21 +99,21 @@ public:
      */
     uint16_t value_slot(const key_type &key) const {
         assert(info->type == bp_node_type::LEAF);
-        ++ctr::value_slot;
+        metrics::add(metrics::event::VALUE_SLOT);
         auto it = std::lower_bound(keys, keys + info->size, key);
         return std::distance(keys, it);
     }
 
     uint16_t value_slot2(const key_type &key) const {
         assert(info->type == bp_node_type::LEAF);
-        ++ctr::value_slot2;
+        metrics::add(metrics::event::VALUE_SLOT2);
         auto it = std::upper_bound(keys, keys + info->size, key);
         return std::distance(keys, it);
     }
 
     uint16_t child_slot(const key_type &key) const {
         assert(info->type == bp_node_type::INTERNAL);
-        ++ctr::child_slot;
+        metrics::add(metrics::event::CHILD_SLOT);
         auto it = std::upper_bound(keys, keys + info->size, key);
         return std::distance(keys, it);
     }
@@ -2,39 +2,27 @@
 #define BP_TREE_H
 
 #include <algorithm>
+#include <array>
+#include <atomic>
+#include <cmath>
 #include <optional>
 #include <cstring>
+#include <limits>
+#include <memory>
+#include <thread>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
 
-#ifdef LOL_FAT
-#ifdef REDISTRIBUTE
-#ifdef VARIABLE_SPLIT
-#ifdef LOL_RESET
-#define QUIT_FAT
-#endif
-#endif
-#endif
-
-#include <cmath>
-#ifdef FAST_PATH
-#error "FAST_PATH already defined"
-#endif
-#define FAST_PATH
+#include "adaptive_controller.h"
+#include "epoch.h"
+#include "insert_policy.h"
+#include "leaf_filter.h"
+#include "leaf_router.h"
+#include "lookup_cache.h"
+#include "node_views.h"
 #include "outlier_detector.h"
-#endif
-
-#ifdef LIL_FAT
-#ifdef FAST_PATH
-#error "FAST_PATH already defined"
-#endif
-#define FAST_PATH
-#endif
-
-#ifdef TAIL_FAT
-#ifdef FAST_PATH
-#error "FAST_PATH already defined"
-#endif
-#define FAST_PATH
-#endif
+#include "range_aggregate.h"
 
 #ifdef INMEMORY
 
@@ -42,6 +30,12 @@
 
 using BlockManager = InMemoryBlockManager;
 
+#elif defined(TIERED)
+
+#include "tiered_block_manager.h"
+
+using BlockManager = TieredBlockManager;
+
 #else
 
 #include "disk_block_manager.h"
@@ -76,36 +70,29 @@ struct reset_stats {
     void reset() { fails = 0; }
 };
 
-template<typename key_type, typename value_type>
+template<typename key_type, typename value_type, typename policy = quit_policy>
 class bp_tree {
+    // micro benchmarks time the private primitives on their own
+    friend struct bp_tree_probe;
+
     friend std::ostream &operator<<(std::ostream &os, const bp_tree &tree) {
         os << tree.ctr_size << ", " << +tree.ctr_depth << ", " << tree.manager
-           << ", " << tree.ctr_internal << ", " << tree.ctr_leaves << ", "
-           #ifdef REDISTRIBUTE
-           << tree.ctr_redistribute
-           #endif
-           << ", "
-           #ifdef LOL_FAT
-           << tree.ctr_split
-           #endif
-           << ", "
-           #ifdef LOL_FAT
-           << tree.ctr_iqr
-           #endif
-           << ", "
-           #ifdef LOL_FAT
-           << tree.ctr_soft
-           #endif
-           << ", "
-           #ifdef LOL_RESET
-           << tree.ctr_hard
-           #endif
-           << ", "
-#ifdef FAST_PATH
-            << tree.ctr_fp
-#endif
-                ;
-        return ctr::log(os);
+           << ", " << tree.ctr_internal << ", " << tree.ctr_leaves << ", ";
+        if constexpr (policy::redistribute) os << tree.ctr_redistribute;
+        os << ", ";
+        if constexpr (policy::lol_fat) os << tree.ctr_split;
+        os << ", ";
+        if constexpr (policy::lol_fat) os << tree.ctr_iqr;
+        os << ", ";
+        if constexpr (policy::lol_fat) os << tree.ctr_soft;
+        os << ", ";
+        if constexpr (policy::lol_reset) os << tree.ctr_hard;
+        os << ", ";
+        if constexpr (policy::fast_path) os << tree.ctr_fp;
+        metrics::snapshot counters = metrics::collect();
+        os << ", " << counters[metrics::event::LOAD] << ", " << counters[metrics::event::VALUE_SLOT] << ", "
+           << counters[metrics::event::VALUE_SLOT2] << ", " << counters[metrics::event::CHILD_SLOT];
+        return os;
     }
 
     using node_id_t = uint32_t;
@@ -117,52 +104,205 @@ class bp_tree {
     static constexpr uint16_t SPLIT_INTERNAL_POS = node_t::internal_capacity / 2;
     static constexpr uint16_t SPLIT_LEAF_POS = (node_t::leaf_capacity + 1) / 2;
     static constexpr uint16_t IQR_SIZE_THRESH = SPLIT_LEAF_POS;
+    static constexpr uint16_t COMPACT_FILL = node_t::leaf_capacity * 9 / 10;  // compaction fills leaves up to this
     static constexpr node_id_t INVALID_NODE_ID = -1;
+    static constexpr uint8_t FP_SLOTS = policy::fast_paths - 1;  // parked fast paths
+
+    static_assert(policy::fast_paths == 1 || (policy::variable_split && !policy::adaptive),
+                  "multiple fast paths require QuIT");
+
+    // state of a parked fast path, the active one lives in the fp_* and lol_* members
+    struct fp_slot {
+        node_id_t id;
+        key_type min;
+        key_type max;
+        path_t path;
+        node_id_t prev_id;
+        key_type prev_min;
+        uint16_t prev_size;
+        uint16_t size;
+        uint8_t fails;
+        uint64_t last_use;
+    };
+
+    // routing entry of a parked fast path, kept sorted by min
+    struct fp_range {
+        key_type min;  // lowest() for the head
+        key_type max;  // only valid if has_max (not the tail)
+        bool has_max;
+        uint8_t slot;
+    };
 
     BlockManager &manager;
     const node_id_t root_id;
     node_id_t head_id;
     node_id_t tail_id;
-#ifdef FAST_PATH
+    // fast path (unused when fast_path() is false)
     node_id_t fp_id;
     key_type fp_min;
     key_type fp_max;
     path_t fp_path;
-#ifdef LOL_FAT
+    // lol (unused when lol_fat() is false)
     dist_f dist;
     node_id_t lol_prev_id;
-#ifdef LOL_RESET
     reset_stats life;
-#endif
     // iqr
     key_type lol_prev_min;
     uint16_t lol_prev_size;
     uint16_t lol_size;
-#endif
-#endif
+    std::unique_ptr<outlier_detector<key_type>> detector;
+    // picks the strategy (unused unless policy::adaptive)
+    adaptive_controller<key_type> controller;
+    // parked fast paths (unused unless policy::fast_paths > 1)
+    std::array<fp_slot, FP_SLOTS> fp_slots;
+    std::array<fp_range, FP_SLOTS> fp_ranges;
+    uint8_t fp_slots_used;
+    uint64_t fp_clock;  // counts the fast path hits
+    uint64_t fp_last_use;  // last hit of the active fast path
+    // compaction resumes from the leaf of this key
+    key_type compact_from;
 
-    // stats
-    uint32_t ctr_size;
-    uint8_t ctr_depth;  // path[ctr_depth - 1] is the root
-    uint32_t ctr_internal;
-    uint32_t ctr_leaves;
-#ifdef FAST_PATH
-    uint32_t ctr_fp;
-#ifdef LOL_FAT
-    uint32_t ctr_split;
-    uint32_t ctr_iqr;
-    uint32_t ctr_soft;
-#endif
-#ifdef LOL_RESET
-    uint32_t ctr_hard;
-#endif
-#ifdef REDISTRIBUTE
-    uint32_t ctr_redistribute;
-#endif
-#endif
+    /**
+     * The tree as it was when a snapshot was taken: blocks modified since then are read from the copies in images,
+     * blocks allocated since then cannot be reached from the snapshot and are never copied
+     */
+    struct snapshot_state {
+        uint8_t depth;
+        node_id_t tail_id;
+        std::unordered_map<node_id_t, node_id_t> images;
+        std::unordered_set<node_id_t> fresh;
+    };
+
+    // learned routing of the slow path (unused until learned_routing(true))
+    leaf_router<key_type, node_id_t, path_t> router;
+    bool routing;
+
+    // filters of the keys of each leaf for lookups (unused until leaf_filters(true))
+    leaf_filter<key_type> filter;
+    bool filtering;
+
+    // leaves of recent lookups (unused until cache_lookups() is given a size)
+    lookup_cache<key_type, node_id_t> hints;
+
+    // internal nodes with their children swizzled (unused unless BlockManager::resident_internals)
+    using views_t = node_views<node_t, node_id_t>;
+    using view_t = typename views_t::view;
+    views_t views;
+    view_t *root_view;  // once the root is an internal node
+
+    // copy-on-write (unused until snapshot() is called)
+    std::vector<std::shared_ptr<snapshot_state>> snapshots;
+    std::unordered_map<node_id_t, uint32_t> image_refs;  // copy -> snapshots reading it
+
+    struct block_release {
+        BlockManager *manager;
+
+        void operator()(uint32_t id) const { manager->free(id); }
+    };
+
+    // blocks dropped by the tree return to the manager once no reader holds them
+    epoch::reclaimer<block_release> reclaim;
+
+    // stats (gauges so that stats() can be called from other threads)
+    metrics::gauge<uint32_t> ctr_size;
+    metrics::gauge<uint8_t> ctr_depth;  // path[ctr_depth - 1] is the root
+    metrics::gauge<uint32_t> ctr_internal;
+    metrics::gauge<uint32_t> ctr_leaves;
+    metrics::gauge<uint32_t> ctr_fp;
+    metrics::gauge<uint32_t> ctr_split;
+    metrics::gauge<uint32_t> ctr_iqr;
+    metrics::gauge<uint32_t> ctr_soft;
+    metrics::gauge<uint32_t> ctr_hard;
+    metrics::gauge<uint32_t> ctr_redistribute;
+
+    // strategy flags: fixed by the policy, or picked at runtime by the adaptive controller
+    [[nodiscard]] bool tail_fat() const {
+        if constexpr (policy::adaptive) return controller.current_mode() == strategy_mode::TAIL;
+        else return policy::tail_fat;
+    }
+
+    [[nodiscard]] bool lil_fat() const {
+        if constexpr (policy::adaptive) return controller.current_mode() == strategy_mode::LIL;
+        else return policy::lil_fat;
+    }
+
+    [[nodiscard]] bool lol_fat() const {
+        if constexpr (policy::adaptive) return controller.current_mode() == strategy_mode::QUIT;
+        else return policy::lol_fat;
+    }
+
+    [[nodiscard]] bool variable_split() const {
+        if constexpr (policy::adaptive) return controller.current_mode() == strategy_mode::QUIT;
+        else return policy::variable_split;
+    }
+
+    [[nodiscard]] bool redistributes() const {
+        if constexpr (policy::adaptive) return controller.current_mode() == strategy_mode::QUIT;
+        else return policy::redistribute;
+    }
+
+    [[nodiscard]] bool lol_reset() const {
+        if constexpr (policy::adaptive) return controller.current_mode() == strategy_mode::QUIT;
+        else return policy::lol_reset;
+    }
+
+    [[nodiscard]] bool fast_path() const {
+        if constexpr (policy::adaptive) return controller.current_mode() != strategy_mode::SIMPLE;
+        else return policy::fast_path;
+    }
+
+    /**
+     * Must precede every change to an existing block: marks it dirty and, while snapshots are alive, keeps a copy of
+     * the block as the snapshots see it
+     */
+    void modify(node_id_t id) {
+        manager.mark_dirty(id);
+        if (!snapshots.empty()) preserve(id);
+    }
+
+    void preserve(node_id_t id) {
+        node_id_t copy = INVALID_NODE_ID;
+        for (const auto &snapshot: snapshots) {
+            if (snapshot->fresh.count(id) || snapshot->images.count(id)) continue;
+            if (copy == INVALID_NODE_ID) {
+                // snapshots taken since the last change of the block all see the same image
+                node_t node;
+                node.load(manager.open_block(id));
+                copy = node.info->type == LEAF ? manager.allocate() : manager.allocate_internal();
+                std::memcpy(manager.open_block(copy), manager.open_block(id), BLOCK_SIZE_BYTES);
+                manager.mark_dirty(copy);
+            }
+            snapshot->images.emplace(id, copy);
+            ++image_refs[copy];
+        }
+    }
+
+    /**
+     * Allocate a block for a new node
+     */
+    node_id_t allocate(bp_node_type type) {
+        node_id_t id = type == LEAF ? manager.allocate() : manager.allocate_internal();
+        for (const auto &snapshot: snapshots) snapshot->fresh.insert(id);
+        if constexpr (BlockManager::resident_internals) {
+            if (type == INTERNAL) views.reset(id, manager.open_block(id));
+        }
+        return id;
+    }
+
+    void release(const std::shared_ptr<snapshot_state> &state) {
+        snapshots.erase(std::find(snapshots.begin(), snapshots.end(), state));
+        for (const auto &[id, copy]: state->images) {
+            auto it = image_refs.find(copy);
+            if (--it->second == 0) {
+                image_refs.erase(it);
+                reclaim.retire(copy);
+            }
+        }
+    }
 
     void create_new_root(const key_type &key, node_id_t node_id) {
-        node_id_t left_node_id = manager.allocate();
+        // the left node takes over the old root, a leaf only while the tree has a single level
+        node_id_t left_node_id = allocate(ctr_depth == 1 ? LEAF : INTERNAL);
         node_t root;
         root.load(manager.open_block(root_id));
         node_t left_node;
@@ -170,11 +310,16 @@ class bp_tree {
         std::memcpy(left_node.info, root.info, BLOCK_SIZE_BYTES);
         left_node.info->id = left_node_id;
         manager.mark_dirty(left_node_id);
+        if (filtering && ctr_depth == 1) filter.move(root_id, left_node_id);
+        // the root stops being a leaf
+        if (ctr_depth == 1) hints.clear();
 
+        modify(root_id);
         if (root.info->type == LEAF) {
             root.to_internal();
         }
-        manager.mark_dirty(root_id);
+        // the children of the root are now one level further down
+        if constexpr (BlockManager::resident_internals) root_view = views.reset(root_id, root.info);
         root.info->size = 1;
         root.keys[0] = key;
         root.children[0] = left_node_id;
@@ -182,15 +327,33 @@ class bp_tree {
         if (root_id == head_id) {
             head_id = left_node_id;
         }
-#ifdef FAST_PATH
-        if (fp_path[ctr_depth-1] == root_id) {
-            if (fp_id == root_id) {
-                fp_id = left_node_id;
+        if (fast_path()) {
+            if (fp_path[ctr_depth - 1] == root_id) {
+                if (fp_id == root_id) {
+                    fp_id = left_node_id;
+                }
+                fp_path[ctr_depth - 1] = left_node_id;
+            }
+            fp_path[ctr_depth] = root_id;
+            if (lol_prev_id == root_id) {
+                lol_prev_id = left_node_id;
+            }
+            if constexpr (FP_SLOTS > 0) {
+                for (uint8_t i = 0; i < fp_slots_used; ++i) {
+                    fp_slot &slot = fp_slots[i];
+                    if (slot.prev_id == root_id) {
+                        slot.prev_id = left_node_id;
+                    }
+                    if (slot.path[ctr_depth - 1] == root_id) {
+                        if (slot.id == root_id) {
+                            slot.id = left_node_id;
+                        }
+                        slot.path[ctr_depth - 1] = left_node_id;
+                    }
+                    slot.path[ctr_depth] = root_id;
+                }
             }
-            fp_path[ctr_depth-1] = left_node_id;
         }
-        fp_path[ctr_depth] = root_id;
-#endif
         ctr_depth++;
         assert(ctr_depth < MAX_DEPTH);
         ctr_internal++;
@@ -198,13 +361,35 @@ class bp_tree {
 
     key_type find_leaf(node_t &node, path_t &path, const key_type &key) const {
         key_type leaf_max = {};
+        if constexpr (BlockManager::resident_internals) {
+            if (ctr_depth > 1) {
+                const view_t *view = root_view;
+                for (uint8_t i = ctr_depth - 1;; --i) {
+                    // from root to last internal level, through the cached views
+                    metrics::add(metrics::event::LOAD);
+                    path[i] = view->node.info->id;
+                    assert(view->node.info->type == INTERNAL);
+
+                    uint16_t slot = view->node.child_slot(key);
+                    if (slot != view->node.info->size) {
+                        leaf_max = view->node.keys[slot];
+                    }
+                    if (i == 1) {
+                        path[0] = view->node.children[slot];
+                        node.load_leaf(leaf_block(*view, slot));
+                        assert(path[0] == node.info->id);
+                        return leaf_max;
+                    }
+                    view = child_view(*view, slot);
+                }
+            }
+        }
         node_id_t child_id = root_id;
         for (uint8_t i = ctr_depth - 1; i > 0; --i) {
             // from root to last internal level
             path[i] = child_id;
-            node.load(manager.open_block(child_id));
+            node.load_internal(manager.open_block(child_id));
             assert(child_id == node.info->id);
-            assert(node.info->type == bp_node_type::INTERNAL);
 
             uint16_t slot = node.child_slot(key);
             if (slot != node.info->size) {
@@ -213,16 +398,212 @@ class bp_tree {
             child_id = node.children[slot];
         }
         path[0] = child_id;
-        node.load(manager.open_block(child_id));
+        node.load_leaf(manager.open_block(child_id));
         assert(child_id == node.info->id);
-        assert(node.info->type == bp_node_type::LEAF);
 
         return leaf_max;
     }
 
-#ifdef REDISTRIBUTE
+    /**
+     * Descend the internal nodes to the leaf that may hold key, without reading the leaf
+     */
+    node_id_t leaf_of(const key_type &key) const {
+        if constexpr (BlockManager::resident_internals) {
+            if (ctr_depth > 1) {
+                const view_t *view = root_view;
+                for (uint8_t i = ctr_depth - 1; i > 1; --i) {
+                    metrics::add(metrics::event::LOAD);
+                    view = child_view(*view, view->node.child_slot(key));
+                }
+                metrics::add(metrics::event::LOAD);
+                return view->node.children[view->node.child_slot(key)];
+            }
+        }
+        node_t node;
+        node_id_t child_id = root_id;
+        for (uint8_t i = ctr_depth - 1; i > 0; --i) {
+            node.load_internal(manager.open_block(child_id));
+            assert(child_id == node.info->id);
+            child_id = node.children[node.child_slot(key)];
+        }
+        return child_id;
+    }
+
+    /**
+     * @return the view of the internal node in child slot of an internal node
+     */
+    const view_t *child_view(const view_t &parent, uint16_t slot) const {
+        return static_cast<const view_t *>(views.follow(parent, slot, [this](node_id_t id) { return views.find(id); }));
+    }
+
+    /**
+     * @return the block of the leaf in child slot of a parent of leaves, through its swizzled pointer when leaves stay
+     * resident
+     */
+    void *leaf_block(const view_t &parent, uint16_t slot) const {
+        if constexpr (BlockManager::resident_leaves) {
+            return views.follow(parent, slot, [this](node_id_t id) { return manager.open_block(id); });
+        } else {
+            return manager.open_block(parent.node.children[slot]);
+        }
+    }
+
+    /**
+     * @return whether key belongs to the leaf of the active fast path
+     */
+    [[nodiscard]] bool on_fast_path(const key_type &key) const {
+        return (fp_id == head_id || fp_min <= key) && (fp_id == tail_id || key < fp_max);
+    }
+
+    /**
+     * Load the leaf of key without a descent when it is the leaf of the fast path or the one before it, where reads
+     * of recently inserted keys land
+     * @return false if key belongs to neither
+     */
+    bool fast_leaf(node_t &leaf, const key_type &key) const {
+        if (!fast_path()) return false;
+        if (on_fast_path(key)) {
+            leaf.load_leaf(manager.open_block(fp_id));
+            assert(fp_id == leaf.info->id);
+            metrics::add(metrics::event::FAST_READ);
+            return true;
+        }
+        if (lol_prev_id == INVALID_NODE_ID || fp_id == head_id || !(key < fp_min)) return false;
+        // not every strategy keeps lol_prev_id up to date, and fp_min may be above the lower bound of the fast leaf
+        leaf.load_leaf(manager.open_block(lol_prev_id));
+        const uint16_t size = leaf.info->size;
+        if (leaf.info->next_id != fp_id || size == 0 || key < leaf.keys[0] || leaf.keys[size - 1] < key) return false;
+        metrics::add(metrics::event::FAST_READ);
+        return true;
+    }
+
+    /**
+     * Load the leaf a scan from key starts in
+     */
+    void start_leaf(node_t &leaf, const key_type &key) const {
+        if (fast_leaf(leaf, key)) return;
+        path_t path;
+        find_leaf(leaf, path, key);
+    }
+
+    /**
+     * About wanted separators of the internal nodes inside (lo, hi), evenly spaced, from the highest level that has
+     * enough of them (or from the parents of the leaves), in increasing order
+     */
+    std::vector<key_type> split_keys(const key_type &lo, const key_type &hi, size_t wanted) const {
+        std::vector<key_type> cuts;
+        std::vector<node_id_t> level{root_id};
+        node_t node;
+        for (uint8_t i = ctr_depth - 1; i > 0; --i) {
+            cuts.clear();
+            std::vector<node_id_t> below;
+            for (node_id_t id: level) {
+                node.load_internal(manager.open_block(id));
+                const uint16_t first = node.child_slot(lo);
+                const uint16_t last = node.child_slot(hi);
+                for (uint16_t slot = first; slot <= last; ++slot) {
+                    if (slot > first && node.keys[slot - 1] < hi) cuts.push_back(node.keys[slot - 1]);
+                    below.push_back(node.children[slot]);
+                }
+            }
+            if (cuts.size() >= wanted) break;
+            level = std::move(below);
+        }
+        if (cuts.size() > wanted) {
+            const size_t stride = cuts.size() / wanted;
+            size_t kept = 0;
+            for (size_t i = stride - 1; i < cuts.size(); i += stride) cuts[kept++] = cuts[i];
+            cuts.resize(kept);
+        }
+        return cuts;
+    }
+
+    /**
+     * Aggregate [lo, hi) on the calling thread
+     */
+    range_aggregate<value_type> aggregate_serial(const key_type &lo, const key_type &hi) const {
+        range_aggregate<value_type> result;
+        node_t leaf;
+        start_leaf(leaf, lo);
+        result.loads = 1;
+        for (uint16_t i = leaf.value_slot(lo);; i = 0) {
+            const uint16_t size = leaf.info->size;
+            const bool last = size > 0 && !(leaf.keys[size - 1] < hi);
+            const uint16_t end = last ? leaf.value_slot(hi) : size;
+            if (i < end) result.add(leaf.values + i, end - i);
+            if (last || leaf.info->id == tail_id) return result;
+            node_id_t next_id = leaf.info->next_id;
+            leaf.load_leaf(manager.open_block(next_id));
+            assert(next_id == leaf.info->id);
+            ++result.loads;
+        }
+    }
+
+    /**
+     * Load the leaf the lookup cache remembers for key, if it still covers key. A leaf covers the keys between its
+     * first and last key, and also the keys below (above) them if it is the head (tail).
+     * @return false on a miss
+     */
+    bool hinted_leaf(node_t &leaf, const key_type &key) const {
+        if (!hints.enabled()) return false;
+        const node_id_t id = hints.hint(key);
+        if (id == hints.NONE) return false;
+        leaf.load_leaf(manager.open_block(id));
+        const uint16_t size = leaf.info->size;
+        if (size == 0 || (id != head_id && key < leaf.keys[0]) || (id != tail_id && leaf.keys[size - 1] < key)) {
+            return false;
+        }
+        metrics::add(metrics::event::CACHED);
+        return true;
+    }
+
+    /**
+     * find_leaf() through the learned router when it is enabled
+     */
+    key_type route_leaf(node_t &node, path_t &path, const key_type &key) {
+        if (!routing || ctr_depth == 1) return find_leaf(node, path, key);
+        if (!router.valid()) build_router();
+        auto pos = router.find(key);
+        path = router.path(pos);
+        path[0] = router.leaf(pos);
+        node.load_leaf(manager.open_block(path[0]));
+        assert(path[0] == node.info->id);
+        return router.upper(pos);
+    }
+
+    void build_router() {
+        router.clear();
+        path_t path{};
+        add_to_router(root_id, ctr_depth - 1, std::numeric_limits<key_type>::lowest(), path);
+        router.fit();
+    }
+
+    /**
+     * Add the leaves under an internal node in key order
+     * @param lower lower bound of the node
+     */
+    void add_to_router(node_id_t id, uint8_t level, const key_type &lower, path_t &path) {
+        node_t node;
+        node.load_internal(manager.open_block(id));
+        path[level] = id;
+        if (level == 1) {
+            router.add_parent(path);
+            for (uint16_t i = 0; i <= node.info->size; ++i) {
+                router.add_leaf(i ? node.keys[i - 1] : lower, node.children[i]);
+            }
+            return;
+        }
+        // copied, the node may not stay in the buffer pool while its children are read
+        std::vector<key_type> keys(node.keys, node.keys + node.info->size);
+        std::vector<node_id_t> children(node.children, node.children + node.info->size + 1);
+        for (size_t i = 0; i < children.size(); ++i) {
+            add_to_router(children[i], level - 1, i ? keys[i - 1] : lower, path);
+        }
+    }
+
     void update_internal(const path_t &path, const key_type &old_key,
                          const key_type &new_key) {
+        if (routing && router.valid()) router.rekey(old_key, new_key);
         node_t node;
         for (uint8_t i = 1; i < ctr_depth; i++) {
             node_id_t node_id = path[i];
@@ -231,14 +612,13 @@ class bp_tree {
             assert(node.info->type == bp_node_type::INTERNAL);
             uint16_t index = node.child_slot(old_key) - 1;
             if (index < node.info->size && node.keys[index] == old_key) {
-                manager.mark_dirty(node_id);
+                modify(node_id);
                 node.keys[index] = new_key;
                 return;
             }
         }
         assert(false);
     }
-#endif
 
     void internal_insert(const path_t &path, key_type key, node_id_t child_id, uint16_t split_pos) {
         node_t node;
@@ -249,7 +629,7 @@ class bp_tree {
             assert(node.info->type == bp_node_type::INTERNAL);
             uint16_t index = node.child_slot(key);
             assert(index == node.info->size || node.keys[index] != key);
-            manager.mark_dirty(node_id);
+            modify(node_id);
             if (node.info->size < node_t::internal_capacity) {
                 // insert new key
                 std::memmove(node.keys + index + 1, node.keys + index, (node.info->size - index) * sizeof(key_type));
@@ -262,7 +642,7 @@ class bp_tree {
             }
 
             // split the node
-            node_id_t new_node_id = manager.allocate();
+            node_id_t new_node_id = allocate(INTERNAL);
             node_t new_node;
             new_node.init(manager.open_block(new_node_id), INTERNAL);
             manager.mark_dirty(new_node_id);
@@ -311,18 +691,25 @@ class bp_tree {
 
                 key = node.keys[node.info->size];
             }
-#ifdef FAST_PATH
-            // update_paths
-            if (fp_path[i] == node_id && fp_id != head_id && key <= fp_min) {
-                fp_path[i] = new_node_id;
+            if (fast_path()) {
+                // update_paths
+                if (fp_path[i] == node_id && fp_id != head_id && key <= fp_min) {
+                    fp_path[i] = new_node_id;
+                }
+                if constexpr (FP_SLOTS > 0) {
+                    for (uint8_t j = 0; j < fp_slots_used; ++j) {
+                        fp_slot &slot = fp_slots[j];
+                        if (slot.path[i] == node_id && slot.id != head_id && key <= slot.min) {
+                            slot.path[i] = new_node_id;
+                        }
+                    }
+                }
             }
-#endif
             child_id = new_node_id;
         }
         create_new_root(key, child_id);
     }
 
-#ifdef REDISTRIBUTE
     void redistribute(const node_t &leaf, uint16_t index, const key_type &key,
                       const value_type &value) {
         assert(lol_prev_id != INVALID_NODE_ID);
@@ -330,7 +717,7 @@ class bp_tree {
         // move values from leaf to leaf prev
         uint16_t items =
             IQR_SIZE_THRESH - lol_prev_size;  // items to be moved to lol prev
-        manager.mark_dirty(lol_prev_id);
+        modify(lol_prev_id);
         node_t lol_prev;
         lol_prev.load(manager.open_block(lol_prev_id));
         assert(lol_prev_id == lol_prev.info->id);
@@ -382,12 +769,15 @@ class bp_tree {
         lol_prev_size = IQR_SIZE_THRESH;
         leaf.info->size = lol_size;
         lol_prev.info->size = IQR_SIZE_THRESH;
+        if (filtering) {
+            filter.rebuild(lol_prev_id, lol_prev.keys, lol_prev.info->size);
+            filter.rebuild(leaf.info->id, leaf.keys, leaf.info->size);
+        }
     }
-#endif
 
     bool leaf_insert(node_t &leaf, const path_t &path, const key_type &key,
                      const value_type &value) {
-        manager.mark_dirty(leaf.info->id);
+        modify(leaf.info->id);
         uint16_t index = leaf.value_slot(key);
         if (index < leaf.info->size && leaf.keys[index] == key) {
             // update value
@@ -405,62 +795,64 @@ class bp_tree {
             leaf.keys[index] = key;
             leaf.values[index] = value;
             ++leaf.info->size;
-#ifdef LOL_FAT
-            if (leaf.info->id == fp_id) {
-                lol_size++;
-            } else if (leaf.info->next_id == fp_id) {
-                lol_prev_id = leaf.info->id;
-                lol_prev_min = leaf.keys[0];
-                lol_prev_size = leaf.info->size;
+            if (filtering) filter.add(leaf.info->id, key);
+            if (lol_fat()) {
+                if (leaf.info->id == fp_id) {
+                    lol_size++;
+                } else if (leaf.info->next_id == fp_id) {
+                    lol_prev_id = leaf.info->id;
+                    lol_prev_min = leaf.keys[0];
+                    lol_prev_size = leaf.info->size;
+                }
             }
-#endif
             return true;
         }
 
         // how many elements should be on the left side after split
         uint16_t split_leaf_pos = SPLIT_LEAF_POS;
-#ifdef LOL_FAT
-#ifdef VARIABLE_SPLIT
+        if constexpr (policy::adaptive) {
+            split_leaf_pos = controller.split_leaf_pos(leaf.info->id == tail_id || leaf.info->id == fp_id);
+        }
         bool lol_move = false;
-        if (leaf.info->id == fp_id) {
-            // when splitting leaf, normally we would do it in the middle
-            // but for lol we want to split it where IQR suggests
-            if (lol_prev_id == INVALID_NODE_ID) {
-                lol_move = true;  // move from head
-            } else if (lol_prev_size >= IQR_SIZE_THRESH) {
-                // If IQR has enough information
-                size_t max_distance = IKR::upper_bound(
-                    dist(fp_min, lol_prev_min), lol_prev_size, lol_size);
-                uint16_t outlier_pos = leaf.value_slot2(fp_min + max_distance);
-                if (outlier_pos <= SPLIT_LEAF_POS) {
-                    split_leaf_pos =
-                        outlier_pos;  // keep these good values on current lol
-                                      // and do not move
+        if (variable_split()) {
+            if (leaf.info->id == fp_id) {
+                if constexpr (FP_SLOTS > 0) refresh_lol_prev(leaf);
+                // when splitting leaf, normally we would do it in the middle
+                // but for lol we want to split it where IQR suggests
+                if (lol_prev_id == INVALID_NODE_ID) {
+                    lol_move = true;  // move from head
+                } else if (lol_prev_size >= IQR_SIZE_THRESH) {
+                    // If IQR has enough information
+                    size_t max_distance = detector->upper_bound(
+                        dist(fp_min, lol_prev_min), lol_prev_size, lol_size);
+                    uint16_t outlier_pos = leaf.value_slot2(fp_min + max_distance);
+                    if (outlier_pos <= SPLIT_LEAF_POS) {
+                        split_leaf_pos =
+                            outlier_pos;  // keep these good values on current lol
+                                          // and do not move
+                    } else {
+                        // most of the values are certainly good
+                        uint16_t margin = detector->split_margin();
+                        if (outlier_pos - margin < SPLIT_LEAF_POS)
+                            split_leaf_pos = SPLIT_LEAF_POS;
+                        else
+                            split_leaf_pos = outlier_pos - margin;
+                        lol_move = true;  // also move lol
+                    }
+                    if (index < outlier_pos) {
+                        split_leaf_pos++;  // this key will be also in the current
+                                           // leaf
+                    }
+                } else if (redistributes()) {
+                    redistribute(leaf, index, key, value);
+                    return true;
                 } else {
-                    // most of the values are certainly good
-                    if (outlier_pos - 10 < SPLIT_LEAF_POS)
-                        split_leaf_pos = SPLIT_LEAF_POS;
-                    else
-                        split_leaf_pos = outlier_pos - 10;
-                    lol_move = true;  // also move lol
-                }
-                if (index < outlier_pos) {
-                    split_leaf_pos++;  // this key will be also in the current
-                                       // leaf
+                    lol_move = true;
                 }
-            } else {
-#ifdef REDISTRIBUTE
-                redistribute(leaf, index, key, value);
-                return true;
-#else
-                lol_move = true;
-#endif
             }
         }
-#endif
-#endif
         // split the leaf
-        node_id_t new_leaf_id = manager.allocate();
+        node_id_t new_leaf_id = allocate(LEAF);
         node_t new_leaf;
         new_leaf.init(manager.open_block(new_leaf_id), LEAF);
         manager.mark_dirty(new_leaf_id);
@@ -486,12 +878,12 @@ class bp_tree {
                          (leaf.info->size - index - 1) * sizeof(value_type));
             leaf.values[index] = value;
 
-#ifdef LIL_FAT
-            // if we insert to left node of split, we set the lil max
-            if (leaf.info->id == fp_id) {
-                fp_max = new_leaf.keys[0];
+            if (lil_fat()) {
+                // if we insert to left node of split, we set the lil max
+                if (leaf.info->id == fp_id) {
+                    fp_max = new_leaf.keys[0];
+                }
             }
-#endif
         } else {
             uint16_t new_index = index - leaf.info->size;
             std::memcpy(new_leaf.keys, leaf.keys + leaf.info->size,
@@ -504,91 +896,362 @@ class bp_tree {
             new_leaf.values[new_index] = value;
             std::memcpy(new_leaf.values + new_index + 1, leaf.values + index,
                         (node_t::leaf_capacity - index) * sizeof(value_type));
-#ifdef LIL_FAT
-            if (leaf.info->id == fp_id) {
-                fp_id = new_leaf.info->id;
-                // if we insert to right split node, we set leaf min
-                fp_min = new_leaf.keys[0];
-                fp_path[0] = fp_id;
+            if (lil_fat()) {
+                if (leaf.info->id == fp_id) {
+                    fp_id = new_leaf.info->id;
+                    // if we insert to right split node, we set leaf min
+                    fp_min = new_leaf.keys[0];
+                    fp_path[0] = fp_id;
+                }
             }
-#endif
         }
         if (leaf.info->id == tail_id) {
             tail_id = new_leaf_id;
-#ifdef TAIL_FAT
-            fp_min = new_leaf.keys[0];
-            fp_path[0] = new_leaf_id;
-            fp_id = new_leaf_id;
-#endif
-        }
-#ifdef LOL_FAT
-        if (leaf.info->id == fp_id) {
-            ctr_split++;
-#ifndef VARIABLE_SPLIT
-            bool lol_move =
-                fp_id == head_id ||  // move lol from head
-                (lol_prev_size >= IQR_SIZE_THRESH &&
-                 dist(new_leaf.keys[0], fp_min) <
-                     IKR::upper_bound(dist(fp_min, lol_prev_min), lol_prev_size,
-                                      leaf.info->size));
-#endif
-            if (lol_move) {
-                ctr_iqr++;
-                // lol believes that the new leaf is not an outlier
-                lol_prev_min = fp_min;
-                lol_prev_size = leaf.info->size;
-                lol_prev_id = fp_id;
-                fp_id = new_leaf_id;
+            if (tail_fat()) {
                 fp_min = new_leaf.keys[0];
-                lol_size = new_leaf.info->size;
-                fp_path[0] = fp_id;
-            } else {
-                fp_max = new_leaf.keys[0];
-                lol_size = leaf.info->size;
+                fp_path[0] = new_leaf_id;
+                fp_id = new_leaf_id;
             }
-        } else if (new_leaf.info->next_id == fp_id) {
-            lol_prev_id = new_leaf_id;
-            lol_prev_min = new_leaf.keys[0];
-            lol_prev_size = new_leaf.info->size;
         }
-#endif
+        if (lol_fat()) {
+            if (leaf.info->id == fp_id) {
+                ctr_split++;
+                if (!variable_split()) {
+                    lol_move =
+                        fp_id == head_id ||  // move lol from head
+                        (lol_prev_size >= IQR_SIZE_THRESH &&
+                         dist(new_leaf.keys[0], fp_min) <
+                             detector->upper_bound(dist(fp_min, lol_prev_min), lol_prev_size,
+                                              leaf.info->size));
+                }
+                if (lol_move) {
+                    ctr_iqr++;
+                    // lol believes that the new leaf is not an outlier
+                    detector->observe(leaf.keys, leaf.info->size);
+                    lol_prev_min = fp_min;
+                    lol_prev_size = leaf.info->size;
+                    lol_prev_id = fp_id;
+                    fp_id = new_leaf_id;
+                    fp_min = new_leaf.keys[0];
+                    lol_size = new_leaf.info->size;
+                    fp_path[0] = fp_id;
+                } else {
+                    fp_max = new_leaf.keys[0];
+                    lol_size = leaf.info->size;
+                }
+            } else if (new_leaf.info->next_id == fp_id) {
+                lol_prev_id = new_leaf_id;
+                lol_prev_min = new_leaf.keys[0];
+                lol_prev_size = new_leaf.info->size;
+            }
+        }
+
+        if (filtering) {
+            filter.rebuild(leaf.info->id, leaf.keys, leaf.info->size);
+            filter.rebuild(new_leaf_id, new_leaf.keys, new_leaf.info->size);
+        }
 
         // insert new key to parent
-        internal_insert(path, new_leaf.keys[0], new_leaf_id,
+        const key_type separator = new_leaf.keys[0];
+        const uint32_t internal = ctr_internal;
+        internal_insert(path, separator, new_leaf_id,
                         SPLIT_INTERNAL_POS);
+        if (routing && router.valid()) {
+            // a split internal node changes the paths of the leaves
+            if (ctr_internal == internal) {
+                router.split(separator, new_leaf_id);
+            } else {
+                router.invalidate();
+            }
+        }
+        return true;
+    }
+
+    /**
+     * Restart the fast path from the tail after a strategy switch. The tail satisfies the invariants of every
+     * strategy, and the fast path state is stale after running without one.
+     */
+    void reset_fast_path() {
+        node_t node;
+        node_id_t child_id = root_id;
+        for (uint8_t i = ctr_depth - 1; i > 0; --i) {
+            fp_path[i] = child_id;
+            node.load(manager.open_block(child_id));
+            assert(node.info->type == bp_node_type::INTERNAL);
+            child_id = node.children[node.info->size];
+        }
+        fp_path[0] = child_id;
+        assert(child_id == tail_id);
+        node.load(manager.open_block(child_id));
+        fp_id = tail_id;
+        fp_min = node.keys[0];
+        fp_max = {};
+        lol_prev_id = INVALID_NODE_ID;
+        lol_size = node.info->size;
+        life.reset();
+    }
+
+    void adapt() {
+        strategy_mode prev = controller.current_mode();
+        controller.end_window(ctr_fp, ctr_hard);
+        life.threshold = controller.reset_threshold();
+        if (controller.current_mode() != prev) {
+            reset_fast_path();
+        }
+    }
+
+    /**
+     * @return whether a fast path, active or parked, holds the leaf or the leaf before it
+     */
+    [[nodiscard]] bool pinned(node_id_t id) const {
+        if (id == fp_id || id == lol_prev_id) return true;
+        for (uint8_t i = 0; i < fp_slots_used; ++i) {
+            if (fp_slots[i].id == id || fp_slots[i].prev_id == id) return true;
+        }
+        return false;
+    }
+
+    /**
+     * Follow a leaf that took the first keys of the leaf after it, widening the ranges of the fast paths on it
+     * @param upper new upper bound of the leaf, nullptr if it became the tail
+     */
+    void grew(const node_t &leaf, const key_type *upper) {
+        const node_id_t id = leaf.info->id;
+        assert((upper == nullptr) == (id == tail_id));
+        if (id == fp_id) {
+            lol_size = leaf.info->size;
+            if (upper != nullptr) fp_max = *upper;
+        }
+        if (id == lol_prev_id) lol_prev_size = leaf.info->size;
+        if constexpr (FP_SLOTS > 0) {
+            for (uint8_t i = 0; i < fp_slots_used; ++i) {
+                fp_slot &slot = fp_slots[fp_ranges[i].slot];
+                if (slot.id == id) {
+                    slot.size = leaf.info->size;
+                    if (upper != nullptr) slot.max = fp_ranges[i].max = *upper;
+                    fp_ranges[i].has_max = upper != nullptr;
+                }
+                if (slot.prev_id == id) slot.prev_size = leaf.info->size;
+            }
+        }
+        if (filtering) filter.rebuild(id, leaf.keys, leaf.info->size);
+    }
+
+    /**
+     * Move keys to the left along the children of a parent of leaves, from child slot on, until each leaf holds
+     * COMPACT_FILL keys; leaves that end up empty are unlinked and retired. Leaves the fast paths start from are not
+     * emptied nor shrunk, their bounds would change.
+     * @param upper upper bound of the parent, nullptr if the parent is the last node of its level
+     * @param budget leaves that may still be read, decreased
+     * @param resume set to the key to go on from when the budget runs out
+     * @param changed set when keys moved
+     * @return whether the parent was done
+     */
+    bool compact_parent(node_t &parent, uint16_t slot, node_t &dst, const key_type *upper, size_t &budget,
+                        key_type &resume, bool &changed) {
+        const node_id_t parent_id = parent.info->id;
+        node_id_t dst_id = parent.children[slot];
+        node_id_t src_id = INVALID_NODE_ID;
+        node_t src;
+        // a buffer pool may hand the frames of the parent and dst to the blocks read after them, so open them again
+        // before each use; src is opened last and the three stay resident as long as the pool holds three blocks
+        auto reopen = [&] {
+            if constexpr (!BlockManager::resident_internals) parent.load_internal(manager.open_block(parent_id));
+            if constexpr (!BlockManager::resident_leaves) {
+                dst.load_leaf(manager.open_block(dst_id));
+                if (src_id != INVALID_NODE_ID) src.load_leaf(manager.open_block(src_id));
+            }
+        };
+        uint16_t s = slot + 1;
+        for (reopen(); s <= parent.info->size; reopen()) {
+            if (budget == 0) {
+                resume = dst.keys[0];
+                return false;
+            }
+            src_id = parent.children[s];
+            src.load_leaf(manager.open_block(src_id));
+            assert(src_id == src.info->id);
+            --budget;
+            reopen();
+            const uint16_t room = dst.info->size < COMPACT_FILL ? COMPACT_FILL - dst.info->size : 0;
+            if (room == 0 || pinned(src_id)) {
+                dst = src;
+                dst_id = src_id;
+                src_id = INVALID_NODE_ID;
+                ++s;
+                continue;
+            }
+            const uint16_t moved = std::min(room, src.info->size);
+            modify(dst_id);
+            modify(src_id);  // the snapshots keep the old contents, also when the block is retired
+            modify(parent_id);
+            reopen();  // the copies for the snapshots go through the buffer pool too
+            std::memcpy(dst.keys + dst.info->size, src.keys, moved * sizeof(key_type));
+            std::memcpy(dst.values + dst.info->size, src.values, moved * sizeof(value_type));
+            dst.info->size += moved;
+            if (moved == src.info->size) {
+                // drop the empty leaf, the next child moves into slot s
+                dst.info->next_id = src.info->next_id;
+                std::memmove(parent.keys + s - 1, parent.keys + s, (parent.info->size - s) * sizeof(key_type));
+                std::memmove(parent.children + s, parent.children + s + 1,
+                             (parent.info->size - s) * sizeof(node_id_t));
+                --parent.info->size;
+                if (src_id == tail_id) tail_id = dst_id;
+                ctr_leaves = ctr_leaves - 1;
+                reclaim.retire(src_id);
+                // the last child takes the bound of the parent
+                grew(dst, s <= parent.info->size ? &parent.keys[s - 1] : upper);
+            } else {
+                std::memmove(src.keys, src.keys + moved, (src.info->size - moved) * sizeof(key_type));
+                std::memmove(src.values, src.values + moved, (src.info->size - moved) * sizeof(value_type));
+                src.info->size -= moved;
+                parent.keys[s - 1] = src.keys[0];
+                grew(dst, &parent.keys[s - 1]);
+                if (filtering) filter.rebuild(src_id, src.keys, src.info->size);
+                dst = src;
+                dst_id = src_id;
+                ++s;
+            }
+            src_id = INVALID_NODE_ID;
+            changed = true;
+        }
         return true;
     }
 
-#ifdef LOL_FAT
+    /**
+     * Parked fast paths do not follow their neighbours, so before splitting the fast node read the previous leaf
+     * again instead of trusting lol_prev_size (redistribute relies on it).
+     */
+    void refresh_lol_prev(const node_t &leaf) {
+        lol_size = leaf.info->size;
+        if (lol_prev_id == INVALID_NODE_ID) return;
+        node_t lol_prev;
+        lol_prev.load(manager.open_block(lol_prev_id));
+        assert(lol_prev.info->type == bp_node_type::LEAF);
+        if (lol_prev.info->next_id != fp_id) {
+            lol_prev_id = INVALID_NODE_ID;
+            return;
+        }
+        lol_prev_min = lol_prev.keys[0];
+        lol_prev_size = lol_prev.info->size;
+    }
+
+    /**
+     * Store the active fast path in a slot and its range at position pos of the routing table, which is then moved
+     * to keep the table sorted
+     */
+    void park_fast_path(uint8_t slot, uint8_t pos) {
+        fp_slots[slot] = {fp_id, fp_min, fp_max, fp_path, lol_prev_id, lol_prev_min, lol_prev_size, lol_size,
+                          life.fails, fp_last_use};
+        fp_range range{fp_id == head_id ? std::numeric_limits<key_type>::lowest() : fp_min, fp_max,
+                       fp_id != tail_id, slot};
+        for (; pos > 0 && range.min < fp_ranges[pos - 1].min; --pos) {
+            fp_ranges[pos] = fp_ranges[pos - 1];
+        }
+        for (; pos + 1 < fp_slots_used && fp_ranges[pos + 1].min < range.min; ++pos) {
+            fp_ranges[pos] = fp_ranges[pos + 1];
+        }
+        fp_ranges[pos] = range;
+    }
+
+    /**
+     * Make a parked fast path the active one; the active one takes its slot
+     * @param pos position of the parked fast path in the routing table
+     */
+    void swap_fast_path(uint8_t pos) {
+        uint8_t slot = fp_ranges[pos].slot;
+        fp_slot next = fp_slots[slot];
+        park_fast_path(slot, pos);
+        fp_id = next.id;
+        fp_min = next.min;
+        fp_max = next.max;
+        fp_path = next.path;
+        lol_prev_id = next.prev_id;
+        lol_prev_min = next.prev_min;
+        lol_prev_size = next.prev_size;
+        lol_size = next.size;
+        life.fails = next.fails;
+        fp_last_use = next.last_use;
+    }
+
+    /**
+     * Keep the active fast path before a hard reset, replacing the least recently used one when all slots are taken
+     */
+    void keep_fast_path() {
+        if (fp_slots_used < FP_SLOTS) {
+            uint8_t pos = fp_slots_used++;
+            park_fast_path(pos, pos);
+            return;
+        }
+        uint8_t pos = 0;
+        for (uint8_t i = 1; i < FP_SLOTS; ++i) {
+            if (fp_slots[fp_ranges[i].slot].last_use < fp_slots[fp_ranges[pos].slot].last_use) pos = i;
+        }
+        park_fast_path(fp_ranges[pos].slot, pos);
+    }
+
+    /**
+     * @return position of the parked fast path whose range contains key, or -1
+     */
+    int find_fast_path(const key_type &key) const {
+        // the table is tiny, counting is cheaper than a binary search with unpredictable branches
+        uint8_t pos = 0;
+        for (uint8_t i = 0; i < fp_slots_used; ++i) {
+            pos += fp_ranges[i].min <= key;
+        }
+        if (pos == 0) return -1;
+        const fp_range &range = fp_ranges[pos - 1];
+        return !range.has_max || key < range.max ? pos - 1 : -1;
+    }
+
+    /**
+     * @return position of the parked fast path whose range ends at key, or -1
+     */
+    int find_fast_path_before(const key_type &key) const {
+        auto end = fp_ranges.begin() + fp_slots_used;
+        auto it = std::lower_bound(fp_ranges.begin(), end, key,
+                                   [](const fp_range &r, const key_type &key) { return r.has_max && r.max < key; });
+        return it != end && it->has_max && it->max == key ? it - fp_ranges.begin() : -1;
+    }
+
+    /**
+     * @return position of the parked fast path on leaf id, or -1
+     */
+    int find_fast_path_leaf(node_id_t id) const {
+        for (uint8_t i = 0; i < fp_slots_used; ++i) {
+            if (fp_slots[fp_ranges[i].slot].id == id) return i;
+        }
+        return -1;
+    }
+
     static std::size_t cmp(const key_type &max, const key_type &min) { return max - min; }
-#endif
 
 public:
-    explicit bp_tree(BlockManager &m) : manager(m), root_id(m.allocate())
-#ifdef LOL_RESET
-          ,
-          life(sqrt(node_t::leaf_capacity)),
-          ctr_hard(0)
-#endif
-    {
+    explicit bp_tree(BlockManager &m, const outlier_config &outliers = {}) :
+            manager(m),
+            root_id(m.allocate_internal()),
+            life(sqrt(node_t::leaf_capacity)),
+            detector(make_outlier_detector<key_type>(outliers)),
+            controller(node_t::leaf_capacity, life.threshold),
+            filter(node_t::leaf_capacity, root_id),
+            reclaim(block_release{&m}) {
         head_id = tail_id = root_id;
-#ifdef FAST_PATH
         fp_id = root_id;
         fp_path[0] = fp_id;
         fp_min = {};
         fp_max = {};
-        ctr_fp = 0;
-#ifdef LOL_FAT
         dist = cmp;
         lol_prev_id = INVALID_NODE_ID;
         lol_prev_min = {};
         lol_prev_size = 0;
         lol_size = 0;
-        ctr_split = 0;
-        ctr_iqr = 0;
-        ctr_soft = 0;
-#endif
-#endif
+        fp_slots_used = 0;
+        fp_clock = 0;
+        fp_last_use = 0;
+        compact_from = std::numeric_limits<key_type>::lowest();
+        root_view = nullptr;
+        routing = false;
+        filtering = false;
         node_t root;
         root.init(manager.open_block(root_id), LEAF);
         manager.mark_dirty(root_id);
@@ -600,9 +1263,21 @@ public:
         ctr_depth = 1;
         ctr_internal = 0;
         ctr_leaves = 1;
-#ifdef REDISTRIBUTE
+        ctr_fp = 0;
+        ctr_split = 0;
+        ctr_iqr = 0;
+        ctr_soft = 0;
+        ctr_hard = 0;
         ctr_redistribute = 0;
-#endif
+    }
+
+    bp_tree(const bp_tree &) = delete;
+
+    bp_tree &operator=(const bp_tree &) = delete;
+
+    ~bp_tree() {
+        assert(snapshots.empty());
+        reclaim.drain();
     }
 
     bool top_insert(const key_type &key, const value_type &value) {
@@ -614,78 +1289,234 @@ public:
 
     bool insert(const key_type &key, const value_type &value) {
         node_t leaf;
-#ifdef FAST_PATH
+        if constexpr (policy::adaptive) {
+            if (controller.observe(key)) adapt();
+        }
+        if (fast_path()) {
 #ifdef PLOT_FAST
-        std::cout << key << ',' << ctr_fp << std::endl;
+            std::cout << key << ',' << ctr_fp << std::endl;
 #endif
-        if ((fp_id == head_id || fp_min <= key) &&
-            (fp_id == tail_id || key < fp_max)) {
-            ctr_fp++;
-            leaf.load(manager.open_block(fp_id));
-            assert(fp_id == leaf.info->id);
-            assert(leaf.info->type == bp_node_type::LEAF);
-#ifdef LOL_RESET
-            life.success();
-#endif
-            return leaf_insert(leaf, fp_path, key, value);
+            bool hit = on_fast_path(key);
+            if constexpr (FP_SLOTS > 0) {
+                if (!hit) {
+                    int pos = find_fast_path(key);
+                    if (pos >= 0) {
+                        swap_fast_path(pos);
+                        hit = true;
+                    }
+                }
+            }
+            if (hit) {
+                ctr_fp++;
+                leaf.load_leaf(manager.open_block(fp_id));
+                assert(fp_id == leaf.info->id);
+                // each fast path counts its own misses, the parked ones keep theirs in their slot
+                if (lol_reset()) life.success();
+                if constexpr (FP_SLOTS > 0) fp_last_use = ++fp_clock;
+                return leaf_insert(leaf, fp_path, key, value);
+            }
         }
-#endif
-#ifdef LIL_FAT
-        path_t &path = fp_path;  // update fp_path
-#else
-        path_t path;
-#endif
-        key_type leaf_max = find_leaf(leaf, path, key);
-#ifdef LIL_FAT
-        // update rest of lil
-        fp_id = leaf.info->id;
-        if (fp_id != head_id) fp_min = leaf.keys[0];
-        if (fp_id != tail_id) fp_max = leaf_max;
-#endif
-#ifdef LOL_FAT
-        // if the new inserted key goes to lol->next, check if lol->next is not
-        // an outlier it might be the case that lol reached the previous
-        // outliers.
-        if (lol_prev_id != INVALID_NODE_ID &&  // lol->prev info exist
-                                               //            fp_id != head_id &&
-                                               //            // fp_min is valid
-            fp_id != tail_id &&                // fp_max is valid
-            //            leaf.info->id != tail_id && // don't go to tail
-            fp_max == leaf.keys[0] &&  // leaf is lol->next
-            // TODO: IQR doesn't have enough values but this kinda works
-            // lol_prev_size >= IQR_SIZE_THRESH && lol_size >= IQR_SIZE_THRESH &&
-            dist(fp_max, fp_min) < IKR::upper_bound(dist(fp_min, lol_prev_min), lol_prev_size, lol_size)) {
-            // move lol to lol->next = leaf
-            lol_prev_min = fp_min;
-            lol_prev_size = lol_size;
-            lol_prev_id = fp_id;
-            fp_id = leaf.info->id;
-            fp_min = fp_max;
-            fp_max = leaf_max;
-            lol_size = leaf.info->size;
-            fp_path = path;
-            ctr_soft++;
-#ifdef LOL_RESET
-            life.reset();
-        } else if (life.failure()) {
-            ++ctr_hard;
-            lol_prev_id = INVALID_NODE_ID;
+        path_t top_path;
+        path_t &path = lil_fat() ? fp_path : top_path;  // lil updates fp_path
+        key_type leaf_max = route_leaf(leaf, path, key);
+        if (lil_fat()) {
+            // update rest of lil
             fp_id = leaf.info->id;
-            fp_min = leaf.keys[0];
-            fp_max = leaf_max;
-            lol_size = leaf.info->size;
-            fp_path = path;
-            life.reset();
-#endif
+            if (fp_id != head_id) fp_min = leaf.keys[0];
+            if (fp_id != tail_id) fp_max = leaf_max;
+        }
+        if constexpr (FP_SLOTS > 0) {
+            if (leaf.info->size > 0) {
+                // the leaf may belong to a parked fast path (that missed the key), or follow one
+                int pos = find_fast_path_leaf(leaf.info->id);
+                if (pos >= 0) {
+                    swap_fast_path(pos);
+                    return leaf_insert(leaf, path, key, value);
+                }
+                pos = find_fast_path_before(leaf.keys[0]);
+                if (pos >= 0) {
+                    swap_fast_path(pos);
+                }
+            }
+        }
+        if (lol_fat()) {
+            // if the new inserted key goes to lol->next, check if lol->next is not
+            // an outlier it might be the case that lol reached the previous
+            // outliers.
+            if (lol_prev_id != INVALID_NODE_ID &&  // lol->prev info exist
+                                                   //            fp_id != head_id &&
+                                                   //            // fp_min is valid
+                fp_id != tail_id &&                // fp_max is valid
+                //            leaf.info->id != tail_id && // don't go to tail
+                fp_max == leaf.keys[0] &&  // leaf is lol->next
+                // TODO: IQR doesn't have enough values but this kinda works
+                // lol_prev_size >= IQR_SIZE_THRESH && lol_size >= IQR_SIZE_THRESH &&
+                dist(fp_max, fp_min) < detector->upper_bound(dist(fp_min, lol_prev_min), lol_prev_size, lol_size)) {
+                // move lol to lol->next = leaf
+                lol_prev_min = fp_min;
+                lol_prev_size = lol_size;
+                lol_prev_id = fp_id;
+                fp_id = leaf.info->id;
+                fp_min = fp_max;
+                fp_max = leaf_max;
+                lol_size = leaf.info->size;
+                fp_path = path;
+                ctr_soft++;
+                if (lol_reset()) life.reset();
+            } else if (lol_reset() && life.failure()) {
+                ++ctr_hard;
+                if constexpr (FP_SLOTS > 0) {
+                    keep_fast_path();
+                    fp_last_use = ++fp_clock;
+                }
+                lol_prev_id = INVALID_NODE_ID;
+                fp_id = leaf.info->id;
+                fp_min = leaf.keys[0];
+                fp_max = leaf_max;
+                lol_size = leaf.info->size;
+                fp_path = path;
+                life.reset();
+            }
         }
-#endif
         return leaf_insert(leaf, path, key, value);
     }
 
-    size_t top_k(size_t count, const key_type &min_key) const {
+    /**
+     * Route the inserts that miss the fast path through a learned model of the leaf bounds instead of a descent
+     */
+    void learned_routing(bool enabled) {
+        routing = enabled;
+        router.invalidate();
+    }
+
+    /**
+     * Answer lookups of keys that are not in the tree from in-memory filters of the leaves when possible, without
+     * reading the leaf. Enabling builds the filters of the current leaves.
+     */
+    void leaf_filters(bool enabled) {
+        filtering = enabled;
+        filter.clear();
+        if (!enabled) return;
+        node_t leaf;
+        for (node_id_t id = head_id;; id = leaf.info->next_id) {
+            leaf.load_leaf(manager.open_block(id));
+            filter.rebuild(id, leaf.keys, leaf.info->size);
+            if (id == tail_id) break;
+        }
+    }
+
+    /**
+     * Check the leaf of a recent lookup that hashed to the same entry before descending, which skips the descent for
+     * the hot keys of a skewed read load
+     * @param entries size of the cache, 0 to disable it
+     */
+    void cache_lookups(size_t entries) { hints.resize(entries); }
+
+    /**
+     * One step of an incremental compaction of the leaves, which can be interleaved with inserts to keep its pauses
+     * short. The step goes on along the leaves from where the previous one stopped, and moves keys to the left between
+     * neighbouring leaves of the same parent until each holds COMPACT_FILL keys. Leaves left empty are unlinked from
+     * their parent and from the leaf chain and retired. The internal nodes are not merged.
+     * @param budget leaves read by the step at most
+     * @return true when the step reached the last leaf, the next one starts over from the first
+     */
+    bool compact(size_t budget) {
+        if (ctr_depth == 1) return true;
+        const uint32_t leaves = ctr_leaves;
+        bool changed = false;
+        bool wrapped = false;
+        // a step reads at least a leaf and its right neighbour
+        budget = std::max<size_t>(budget, 2);
+        while (budget > 0 && !wrapped) {
+            node_t dst;
+            path_t path;
+            find_leaf(dst, path, compact_from);
+            --budget;
+            // the upper bound of the parent comes from the lowest ancestor the path does not leave by its last child
+            std::optional<key_type> upper;
+            node_t node;
+            for (uint8_t i = 2; i < ctr_depth && !upper; ++i) {
+                node.load_internal(manager.open_block(path[i]));
+                const uint16_t slot = node.child_slot(compact_from);
+                if (slot != node.info->size) upper = node.keys[slot];
+            }
+            node_t parent;
+            parent.load_internal(manager.open_block(path[1]));
+            const uint16_t slot = parent.child_slot(compact_from);
+            if (!compact_parent(parent, slot, dst, upper ? &*upper : nullptr, budget, compact_from, changed)) break;
+            // go on from the first leaf of the next parent
+            if (dst.info->id == tail_id) {
+                compact_from = std::numeric_limits<key_type>::lowest();
+                wrapped = true;
+            } else {
+                node_t next;
+                next.load_leaf(manager.open_block(dst.info->next_id));
+                compact_from = next.keys[0];
+            }
+        }
+        if (changed && routing) router.invalidate();
+        // retired ids may come back as other blocks
+        if (ctr_leaves != leaves) hints.clear();
+        return wrapped;
+    }
+
+    /**
+     * Fill of the leaves, read from the leaf chain
+     */
+    struct fill_stats {
+        uint64_t leaves;
+        uint64_t entries;
+        uint64_t underfull;  // at most half full
+        double fill;  // entries over the capacity of the leaves
+    };
+
+    [[nodiscard]] fill_stats fill() const {
+        epoch::guard pin;
+        fill_stats stats{};
+        node_t leaf;
+        for (node_id_t id = head_id;; id = leaf.info->next_id) {
+            leaf.load_leaf(manager.open_block(id));
+            ++stats.leaves;
+            stats.entries += leaf.info->size;
+            stats.underfull += leaf.info->size <= node_t::leaf_capacity / 2;
+            if (id == tail_id) break;
+        }
+        stats.fill = static_cast<double>(stats.entries) / (stats.leaves * node_t::leaf_capacity);
+        return stats;
+    }
+
+    /**
+     * Insert a run of keys sorted in increasing order. Strategies with a fast path already keep the leaf of the last
+     * insert, so they take the run through insert(); without one, the keys that fall in the leaf of the previous key
+     * are added to it without a descent.
+     * @return number of new keys
+     */
+    size_t insert_sorted(const key_type *keys, const value_type *values, size_t n) {
+        size_t added = 0;
+        if (policy::adaptive || fast_path()) {
+            for (size_t i = 0; i < n; ++i) added += insert(keys[i], values[i]);
+            return added;
+        }
         node_t leaf;
         path_t path;
-        find_leaf(leaf, path, min_key);
+        key_type leaf_max = {};
+        bool cached = false;
+        for (size_t i = 0; i < n; ++i) {
+            if (!cached || (leaf.info->id != tail_id && !(keys[i] < leaf_max))) {
+                leaf_max = route_leaf(leaf, path, keys[i]);
+            }
+            const uint32_t nodes = ctr_internal + ctr_leaves;
+            added += leaf_insert(leaf, path, keys[i], values[i]);
+            // a split moves part of the leaf away
+            cached = ctr_internal + ctr_leaves == nodes;
+        }
+        return added;
+    }
+
+    size_t top_k(size_t count, const key_type &min_key) const {
+        epoch::guard pin;
+        node_t leaf;
+        start_leaf(leaf, min_key);
         uint16_t index = leaf.value_slot(min_key);
         size_t loads = 1;
         uint16_t curr_size = leaf.info->size - index;
@@ -695,9 +1526,8 @@ public:
                 break;
             }
             node_id_t next_id = leaf.info->next_id;
-            leaf.load(manager.open_block(next_id));
+            leaf.load_leaf(manager.open_block(next_id));
             assert(next_id == leaf.info->id);
-            assert(leaf.info->type == bp_node_type::LEAF);
             curr_size = leaf.info->size;
             ++loads;
         }
@@ -705,27 +1535,39 @@ public:
     }
 
     size_t range(const key_type &min_key, const key_type &max_key) const {
+        epoch::guard pin;
         size_t loads = 1;
         node_t leaf;
-        path_t path;
-        find_leaf(leaf, path, min_key);
+        start_leaf(leaf, min_key);
         while (leaf.keys[leaf.info->size - 1] < max_key) {
             if (leaf.info->id == tail_id) {
                 break;
             }
             node_id_t next_id = leaf.info->next_id;
-            leaf.load(manager.open_block(next_id));
+            leaf.load_leaf(manager.open_block(next_id));
             assert(next_id == leaf.info->id);
-            assert(leaf.info->type == bp_node_type::LEAF);
             ++loads;
         }
         return loads;
     }
 
+    /**
+     * The leaf of the fast path and the one before it are read without a descent, then the lookup cache and the leaf
+     * filters are tried, when enabled
+     */
     std::optional<value_type> get(const key_type &key) const {
+        epoch::guard pin;
         node_t leaf;
-        path_t path;
-        find_leaf(leaf, path, key);
+        if (!fast_leaf(leaf, key) && !hinted_leaf(leaf, key)) {
+            const node_id_t leaf_id = leaf_of(key);
+            if (filtering && !filter.may_contain(leaf_id, key)) {
+                metrics::add(metrics::event::FILTERED);
+                return std::nullopt;
+            }
+            leaf.load_leaf(manager.open_block(leaf_id));
+            assert(leaf_id == leaf.info->id);
+            if (hints.enabled()) hints.remember(key, leaf_id);
+        }
         uint16_t index = leaf.value_slot(key);
         if (index < leaf.info->size && leaf.keys[index] == key) {
             return leaf.values[index];
@@ -734,6 +1576,245 @@ public:
     }
 
     bool contains(const key_type &key) const { return get(key).has_value(); }
+
+    /**
+     * Visit the entries in key order from min_key until visit returns false
+     * @param visit called with each key and value, returns whether to go on
+     * @return number of leaves loaded
+     */
+    template<typename visitor_f>
+    size_t scan(const key_type &min_key, visitor_f &&visit) const {
+        epoch::guard pin;
+        node_t leaf;
+        start_leaf(leaf, min_key);
+        size_t loads = 1;
+        for (uint16_t i = leaf.value_slot(min_key);; i = 0) {
+            for (; i < leaf.info->size; ++i) {
+                if (!visit(leaf.keys[i], leaf.values[i])) return loads;
+            }
+            if (leaf.info->id == tail_id) return loads;
+            node_id_t next_id = leaf.info->next_id;
+            leaf.load_leaf(manager.open_block(next_id));
+            assert(next_id == leaf.info->id);
+            ++loads;
+        }
+    }
+
+    /**
+     * Count, sum, min and max of the values of the keys in [lo, hi). With several threads, the range is cut at the
+     * separators of the highest internal level that splits it in enough pieces, and the threads take the pieces in
+     * turn. Block managers that cannot serve concurrent reads always scan on the calling thread. No insert may run
+     * during the call.
+     * @param threads 1 scans on the calling thread
+     */
+    range_aggregate<value_type> aggregate(const key_type &lo, const key_type &hi, unsigned threads = 1) const {
+        if (!(lo < hi)) return {};
+        epoch::guard pin;
+        if (!BlockManager::concurrent_reads || threads <= 1) return aggregate_serial(lo, hi);
+        // a few pieces per thread even out pieces of different sizes
+        std::vector<key_type> cuts = split_keys(lo, hi, threads * 4);
+        if (cuts.empty()) return aggregate_serial(lo, hi);
+        cuts.insert(cuts.begin(), lo);
+        cuts.push_back(hi);
+        const size_t pieces = cuts.size() - 1;
+        std::vector<range_aggregate<value_type>> results(pieces);
+        std::atomic<size_t> next{0};
+        auto worker = [&]() {
+            epoch::guard worker_pin;
+            for (size_t p; (p = next.fetch_add(1, std::memory_order_relaxed)) < pieces;) {
+                results[p] = aggregate_serial(cuts[p], cuts[p + 1]);
+            }
+        };
+        std::vector<std::thread> workers;
+        for (unsigned t = 1; t < std::min<size_t>(threads, pieces); ++t) workers.emplace_back(worker);
+        worker();
+        for (auto &w: workers) w.join();
+        range_aggregate<value_type> total;
+        for (const auto &r: results) total.merge(r);
+        return total;
+    }
+
+    /**
+     * @return the largest key, nothing if the tree is empty
+     */
+    std::optional<key_type> max_key() const {
+        epoch::guard pin;
+        node_t tail;
+        tail.load_leaf(manager.open_block(tail_id));
+        if (tail.info->size == 0) return std::nullopt;
+        return tail.keys[tail.info->size - 1];
+    }
+
+    /**
+     * A consistent read-only view of the tree as of its creation, for long scans that run while inserts continue.
+     * Blocks are copied lazily, the first time an insert changes one after the snapshot; the copies are freed when
+     * the last snapshot reading them is destroyed and no read of the view is still running. The view must be destroyed
+     * before the tree.
+     */
+    class snapshot_view {
+        const bp_tree *tree;
+        std::shared_ptr<snapshot_state> state;
+
+        [[nodiscard]] void *open(node_id_t id) const {
+            auto it = state->images.find(id);
+            return tree->manager.open_block(it == state->images.end() ? id : it->second);
+        }
+
+        void find_leaf(node_t &node, const key_type &key) const {
+            node_id_t child_id = tree->root_id;
+            for (uint8_t i = state->depth - 1; i > 0; --i) {
+                node.load_internal(open(child_id));
+                child_id = node.children[node.child_slot(key)];
+            }
+            node.load_leaf(open(child_id));
+        }
+
+    public:
+        snapshot_view(const bp_tree *tree, std::shared_ptr<snapshot_state> state) :
+                tree(tree), state(std::move(state)) {}
+
+        snapshot_view(snapshot_view &&other) noexcept : tree(other.tree), state(std::move(other.state)) {}
+
+        snapshot_view &operator=(snapshot_view &&) = delete;
+
+        ~snapshot_view() {
+            if (state) const_cast<bp_tree *>(tree)->release(state);
+        }
+
+        size_t top_k(size_t count, const key_type &min_key) const {
+            epoch::guard pin;
+            node_t leaf;
+            find_leaf(leaf, min_key);
+            uint16_t index = leaf.value_slot(min_key);
+            size_t loads = 1;
+            uint16_t curr_size = leaf.info->size - index;
+            while (count > curr_size) {
+                count -= curr_size;
+                // blocks keep their id in the copies
+                if (leaf.info->id == state->tail_id) {
+                    break;
+                }
+                leaf.load_leaf(open(leaf.info->next_id));
+                curr_size = leaf.info->size;
+                ++loads;
+            }
+            return loads;
+        }
+
+        size_t range(const key_type &min_key, const key_type &max_key) const {
+            epoch::guard pin;
+            size_t loads = 1;
+            node_t leaf;
+            find_leaf(leaf, min_key);
+            while (leaf.keys[leaf.info->size - 1] < max_key) {
+                if (leaf.info->id == state->tail_id) {
+                    break;
+                }
+                leaf.load_leaf(open(leaf.info->next_id));
+                ++loads;
+            }
+            return loads;
+        }
+
+        std::optional<value_type> get(const key_type &key) const {
+            epoch::guard pin;
+            node_t leaf;
+            find_leaf(leaf, key);
+            uint16_t index = leaf.value_slot(key);
+            if (index < leaf.info->size && leaf.keys[index] == key) {
+                return leaf.values[index];
+            }
+            return std::nullopt;
+        }
+
+        bool contains(const key_type &key) const { return get(key).has_value(); }
+
+        /**
+         * Visit the entries in key order from min_key until visit returns false
+         * @param visit called with each key and value, returns whether to go on
+         * @return number of leaves loaded
+         */
+        template<typename visitor_f>
+        size_t scan(const key_type &min_key, visitor_f &&visit) const {
+            epoch::guard pin;
+            node_t leaf;
+            find_leaf(leaf, min_key);
+            size_t loads = 1;
+            for (uint16_t i = leaf.value_slot(min_key);; i = 0) {
+                for (; i < leaf.info->size; ++i) {
+                    if (!visit(leaf.keys[i], leaf.values[i])) return loads;
+                }
+                if (leaf.info->id == state->tail_id) return loads;
+                leaf.load_leaf(open(leaf.info->next_id));
+                ++loads;
+            }
+        }
+
+        /**
+         * @return blocks copied so far to keep this view consistent
+         */
+        [[nodiscard]] size_t copies() const { return state->images.size(); }
+    };
+
+    /**
+     * Freeze the current contents of the tree; inserts made afterwards are not visible through the view
+     */
+    snapshot_view snapshot() {
+        auto state = std::make_shared<snapshot_state>();
+        state->depth = ctr_depth;
+        state->tail_id = tail_id;
+        snapshots.push_back(state);
+        return {this, std::move(state)};
+    }
+
+    /**
+     * @return blocks the tree dropped that have not gone back to the block manager yet, as a read may still hold them
+     */
+    [[nodiscard]] size_t deferred() const { return reclaim.deferred(); }
+
+    /**
+     * Wait for the running reads, then hand every block the tree dropped back to the block manager
+     */
+    void reclaim_all() { reclaim.drain(); }
+
+    /**
+     * Counters that grow with each kind of insert work; comparing two snapshots tells which path an insert took
+     */
+    struct insert_trace {
+        uint32_t fast_path;
+        uint32_t nodes;
+        uint32_t redistribute;
+    };
+
+    [[nodiscard]] insert_trace trace() const {
+        return {ctr_fp, ctr_internal + ctr_leaves, ctr_redistribute};
+    }
+
+    /**
+     * Shape and strategy counters of the tree together with the process-wide hot path counters
+     */
+    struct tree_stats {
+        uint64_t size;
+        uint8_t depth;
+        uint64_t internal;
+        uint64_t leaves;
+        uint64_t fast_path;
+        uint64_t split;
+        uint64_t iqr;
+        uint64_t soft;
+        uint64_t hard;
+        uint64_t redistribute;
+        metrics::snapshot counters;
+    };
+
+    /**
+     * Safe to call from any thread while another thread inserts; the values are read one by one, so they may
+     * belong to different moments of the same insert
+     */
+    [[nodiscard]] tree_stats stats() const {
+        return {ctr_size, ctr_depth, ctr_internal, ctr_leaves, ctr_fp, ctr_split, ctr_iqr, ctr_soft, ctr_hard,
+                ctr_redistribute, metrics::collect()};
+    }
 };
 
 #endif
@@ -4,14 +4,25 @@
 #include <algorithm>
 #include <cstring>
 #include <iostream>
+#include <string>
+#include <vector>
 
 struct Config {
     size_t blocks_in_memory = 15000;
+    std::string huge_pages = "thp";
+    std::string numa = "first_touch";
+    bool compress_blocks = false;
     unsigned raw_read_perc = 0;
     unsigned raw_write_perc = 0;
     unsigned mix_load_perc = 0;
     unsigned mixed_reads_perc = 0;
     unsigned updates_perc = 0;
+    double mixed_qps = 0;
+    std::string mixed_read_distribution = "uniform";
+    double mixed_zipf_theta = .99;
+    unsigned mixed_range_perc = 0;
+    unsigned mixed_range_size = 100;
+    bool snapshot_scans = false;
     unsigned short_range = 0;
     unsigned mid_range = 0;
     unsigned long_range = 0;
@@ -20,9 +31,26 @@ struct Config {
     unsigned seed = 1234;
     unsigned num_r_threads = 1;
     unsigned num_w_threads = 1;
+    unsigned shards = 1;
+    unsigned pipeline_run = 0;
+    unsigned pipeline_producers = 2;
+    bool learned_routing = false;
+    bool leaf_filters = false;
+    size_t lookup_cache = 0;
+    unsigned aggregate_scans = 0;
+    unsigned aggregate_threads = 1;
+    size_t compact_budget = 0;
     std::string results_csv = "results.csv";
+    std::string latency_file;
     bool binary_input = true;
     bool validate = false;
+    bool check_reclamation = false;
+    std::vector<std::string> trees = {"quit"};
+    std::string outlier_detector = "ikr";
+    double outlier_quantile = .9;
+    double outlier_slack = 1 / .7;
+    unsigned outlier_split_margin = 10;
+    unsigned outlier_window = 16;
 
     static std::string str_val(const std::string &val) {
         return val.substr(1, val.size() - 2);
@@ -32,6 +60,19 @@ struct Config {
         return val == "true";
     }
 
+    static std::vector<std::string> list_val(const std::string &val) {
+        std::vector<std::string> items;
+        std::string list = str_val(val);
+        size_t start = 0;
+        while (start <= list.size()) {
+            size_t end = list.find(',', start);
+            if (end == std::string::npos) end = list.size();
+            if (end > start) items.emplace_back(list.substr(start, end - start));
+            start = end + 1;
+        }
+        return items;
+    }
+
     explicit Config(const char *file) {
         if (file == nullptr) return;
 
@@ -49,6 +90,12 @@ struct Config {
             std::string knob_value = line.substr(knob_name.length() + 1, line.size());
             if (knob_name == "BLOCKS_IN_MEMORY") {
                 blocks_in_memory = std::stoi(knob_value);
+            } else if (knob_name == "HUGE_PAGES") {
+                huge_pages = str_val(knob_value);
+            } else if (knob_name == "NUMA") {
+                numa = str_val(knob_value);
+            } else if (knob_name == "COMPRESS_BLOCKS") {
+                compress_blocks = bool_val(knob_value);
             } else if (knob_name == "RAW_READS_PERCENTAGE") {
                 raw_read_perc = std::stoi(knob_value);
             } else if (knob_name == "RAW_WRITES_PERCENTAGE") {
@@ -71,16 +118,62 @@ struct Config {
                 seed = std::stoi(knob_value);
             } else if (knob_name == "MIXED_READ_PERCENTAGE") {
                 mixed_reads_perc = std::stoi(knob_value);
+            } else if (knob_name == "MIXED_QPS") {
+                mixed_qps = std::stod(knob_value);
+            } else if (knob_name == "MIXED_READ_DISTRIBUTION") {
+                mixed_read_distribution = str_val(knob_value);
+            } else if (knob_name == "MIXED_ZIPF_THETA") {
+                mixed_zipf_theta = std::stod(knob_value);
+            } else if (knob_name == "MIXED_RANGE_PERCENTAGE") {
+                mixed_range_perc = std::stoi(knob_value);
+            } else if (knob_name == "MIXED_RANGE_SIZE") {
+                mixed_range_size = std::stoi(knob_value);
+            } else if (knob_name == "SNAPSHOT_SCANS") {
+                snapshot_scans = bool_val(knob_value);
             } else if (knob_name == "RESULTS_FILE") {
                 results_csv = str_val(knob_value);
+            } else if (knob_name == "LATENCY_FILE") {
+                latency_file = str_val(knob_value);
             } else if (knob_name == "NUM_R_THREADS") {
                 num_r_threads = std::stoi(knob_value);
             } else if (knob_name == "NUM_W_THREADS") {
                 num_w_threads = std::stoi(knob_value);
+            } else if (knob_name == "SHARDS") {
+                shards = std::stoi(knob_value);
+            } else if (knob_name == "PIPELINE_RUN") {
+                pipeline_run = std::stoi(knob_value);
+            } else if (knob_name == "PIPELINE_PRODUCERS") {
+                pipeline_producers = std::stoi(knob_value);
+            } else if (knob_name == "LEARNED_ROUTING") {
+                learned_routing = bool_val(knob_value);
+            } else if (knob_name == "LEAF_FILTERS") {
+                leaf_filters = bool_val(knob_value);
+            } else if (knob_name == "LOOKUP_CACHE") {
+                lookup_cache = std::stoul(knob_value);
+            } else if (knob_name == "AGGREGATE_SCANS") {
+                aggregate_scans = std::stoi(knob_value);
+            } else if (knob_name == "AGGREGATE_THREADS") {
+                aggregate_threads = std::stoi(knob_value);
+            } else if (knob_name == "COMPACT_BUDGET") {
+                compact_budget = std::stoul(knob_value);
             } else if (knob_name == "BINARY_INPUT") {
                 binary_input = bool_val(knob_value);
             } else if (knob_name == "VALIDATE") {
                 validate = bool_val(knob_value);
+            } else if (knob_name == "CHECK_RECLAMATION") {
+                check_reclamation = bool_val(knob_value);
+            } else if (knob_name == "TREES") {
+                trees = list_val(knob_value);
+            } else if (knob_name == "OUTLIER_DETECTOR") {
+                outlier_detector = str_val(knob_value);
+            } else if (knob_name == "OUTLIER_QUANTILE") {
+                outlier_quantile = std::stod(knob_value);
+            } else if (knob_name == "OUTLIER_SLACK") {
+                outlier_slack = std::stod(knob_value);
+            } else if (knob_name == "OUTLIER_SPLIT_MARGIN") {
+                outlier_split_margin = std::stoi(knob_value);
+            } else if (knob_name == "OUTLIER_WINDOW") {
+                outlier_window = std::stoi(knob_value);
             } else {
                 std::cerr << "Invalid knob name: " << knob_name << std::endl;
             }
@@ -8,6 +8,11 @@
 #include <unordered_map>
 #include <unordered_set>
 #include <optional>
+#include <vector>
+
+#include "block_arena.h"
+#include "block_codec.h"
+#include "metrics.h"
 
 struct Node {
     uint32_t id;
@@ -107,7 +112,7 @@ public:
         } else {
             auto last = list.removeFromEnd();
             node_hash.erase(last->id);
-            std::pair<uint32_t, uint32_t> res = {last->id, last->pos};
+            std::pair<uint32_t, uint32_t> res = {last->pos, last->id};
             last->id = key;
             list.addToFront(last);
             node_hash[key] = last;
@@ -120,28 +125,94 @@ public:
     }
 };
 
-#ifndef BLOCK_SIZE_BYTES
-#define BLOCK_SIZE_BYTES 4096
-#endif
-
-struct Block {
-    uint8_t block_buf[BLOCK_SIZE_BYTES]{};
-};
-
 class DiskBlockManager {
-    friend std::ostream &operator<<(std::ostream &os, const DiskBlockManager &manager) {
-        os << manager.ctr_writes << ", " << manager.ctr_mark_dirty;
+    // the write and mark dirty columns count the whole process, not this instance
+    friend std::ostream &operator<<(std::ostream &os, const DiskBlockManager &) {
+        metrics::snapshot counters = metrics::collect();
+        os << counters[metrics::event::BLOCK_WRITE] << ", " << counters[metrics::event::MARK_DIRTY];
         return os;
     }
 
+    /**
+     * Where a compressed block is stored in the file
+     */
+    struct slot {
+        off_t offset;
+        uint16_t length;  // block_size when stored raw, 0 when never written
+    };
+
+    static constexpr uint32_t SECTOR = 512;
+    static constexpr uint32_t WORDS = BLOCK_SIZE_BYTES / sizeof(uint32_t);
+    static_assert(BLOCK_SIZE_BYTES % SECTOR == 0, "blocks are stored in whole sectors");
+
     const uint32_t capacity;
     uint32_t next_block_id;
-    Block *internal_memory;
+    const block_arena arena;
+    Block *const internal_memory;
     LRUCache cache;
     int fd;
     std::unordered_set<uint32_t> dirty_nodes;
-    uint32_t ctr_writes;
-    uint32_t ctr_mark_dirty;
+    std::vector<uint32_t> free_ids;
+    // compressed page format (unused unless compress): slots indexed by block id, free slots by number of sectors
+    const bool compress;
+    std::vector<slot> slots;
+    std::vector<std::vector<off_t>> free_slots;
+    off_t file_end;
+    uint8_t scratch[block_codec::bound(WORDS)];
+
+    static uint32_t sectors(uint32_t length) { return (length + SECTOR - 1) / SECTOR; }
+
+    void release_slot(uint32_t id) {
+        if (id >= slots.size() || slots[id].length == 0) return;
+        free_slots[sectors(slots[id].length)].push_back(slots[id].offset);
+        slots[id].length = 0;
+    }
+
+    /**
+     * @return offset of a free slot of count sectors
+     */
+    off_t take_slot(uint32_t count) {
+        if (free_slots[count].empty()) {
+            off_t offset = file_end;
+            file_end += count * SECTOR;
+            return offset;
+        }
+        off_t offset = free_slots[count].back();
+        free_slots[count].pop_back();
+        return offset;
+    }
+
+    /**
+     * Compress a block into the smallest slot that holds it, in place when the number of sectors does not change
+     */
+    void write_compressed(uint32_t id, const uint8_t *buf) {
+        size_t length = block_codec::compress(buf, WORDS, scratch);
+        const uint8_t *data = scratch;
+        if (length >= block_size) {
+            length = block_size;
+            data = buf;
+        }
+        if (id >= slots.size()) slots.resize(id + 1, {0, 0});
+        slot &s = slots[id];
+        if (s.length == 0 || sectors(s.length) != sectors(length)) {
+            release_slot(id);
+            s.offset = take_slot(sectors(length));
+        }
+        s.length = length;
+        pwrite(fd, data, length, s.offset);
+    }
+
+    void read_compressed(uint32_t id, uint8_t *buf) {
+        // a block that was never written holds whatever the frame held, as with the raw format past the end of file
+        if (id >= slots.size() || slots[id].length == 0) return;
+        const slot &s = slots[id];
+        if (s.length == block_size) {
+            pread(fd, buf, block_size, s.offset);
+            return;
+        }
+        pread(fd, scratch, s.length, s.offset);
+        block_codec::decompress(scratch, WORDS, buf);
+    }
 
     /**
      * Write a block to disk
@@ -150,10 +221,14 @@ class DiskBlockManager {
      */
     void write_block(uint32_t id, uint32_t pos) {
         assert(pos < capacity);
+        metrics::add(metrics::event::BLOCK_WRITE);
+        if (compress) {
+            write_compressed(id, internal_memory[pos].block_buf);
+            return;
+        }
         off_t offset = id * block_size;
 //        assert(pwrite(fd, internal_memory[pos].block_buf, block_size, offset) == block_size);
         pwrite(fd, internal_memory[pos].block_buf, block_size, offset);
-        ctr_writes++;
     }
 
     /**
@@ -162,6 +237,10 @@ class DiskBlockManager {
      * @param pos position in internal memory
      */
     void read_block(uint32_t id, uint32_t pos) {
+        if (compress) {
+            read_compressed(id, internal_memory[pos].block_buf);
+            return;
+        }
         off_t offset = id * block_size;
 //        assert(pread(fd, internal_memory[pos].block_buf, block_size, offset) == block_size);
         pread(fd, internal_memory[pos].block_buf, block_size, offset);
@@ -169,22 +248,35 @@ class DiskBlockManager {
 
 public:
     static constexpr uint32_t block_size = BLOCK_SIZE_BYTES;
+    // open_block may evict, one thread at a time
+    static constexpr bool concurrent_reads = false;
+    // an evicted block comes back at another address
+    static constexpr bool resident_internals = false;
+    static constexpr bool resident_leaves = false;
 
-    DiskBlockManager(const char *filepath, uint32_t capacity) :
+    /**
+     * @param filepath
+     * @param capacity buffer pool size in blocks
+     * @param config placement of the buffer pool
+     * @param compress store blocks delta + bitpacked in variable-size slots instead of raw frames
+     */
+    DiskBlockManager(const char *filepath, uint32_t capacity, const arena_config &config = {},
+                     bool compress = false) :
             capacity(capacity),
             next_block_id(0),
+            arena(static_cast<size_t>(capacity) * sizeof(Block), config),
+            internal_memory(static_cast<Block *>(arena.data())),
             cache(capacity),
             dirty_nodes(),
-            ctr_writes(0),
-            ctr_mark_dirty(0) {
-        internal_memory = new Block[capacity];
+            compress(compress),
+            free_slots(block_size / SECTOR + 1),
+            file_end(0) {
         fd = open(filepath, O_RDWR | O_CREAT | O_TRUNC, 0600);
         assert(fd != -1);
     }
 
     ~DiskBlockManager() {
         flush();
-        delete[] internal_memory;
         close(fd);
     }
 
@@ -199,20 +291,56 @@ public:
     }
 
     void reset() {
-        std::cerr << "size: " << next_block_id << std::endl;
+        std::cerr << "size: " << next_block_id;
+        if (compress) std::cerr << ", stored: " << file_end << " bytes";
+        std::cerr << std::endl;
         next_block_id = 0;
+        free_ids.clear();
+        slots.clear();
+        for (auto &offsets: free_slots) offsets.clear();
+        file_end = 0;
+        // the blocks of the old tree are dropped, they must not be flushed into the new one
+        dirty_nodes.clear();
         cache.~LRUCache();
         new(&cache) LRUCache(capacity);
     }
 
     /**
-     * Allocate a block id
+     * Number of block ids handed out so far, freed ones included; every live block id is below it
+     * @return one past the highest block id
+     */
+    [[nodiscard]] uint32_t block_count() const { return next_block_id; }
+
+    /**
+     * Allocate a block id, reusing a freed block if there is one
      * @return block id for the new block
      */
     uint32_t allocate() {
+        if (!free_ids.empty()) {
+            uint32_t id = free_ids.back();
+            free_ids.pop_back();
+            return id;
+        }
         return next_block_id++;
     }
 
+    /**
+     * Allocate a block id for an internal node; internal nodes share the buffer pool of the leaves
+     * @return block id for the new block
+     */
+    uint32_t allocate_internal() { return allocate(); }
+
+    /**
+     * Return a block that is no longer referenced by the tree; its contents are not written back
+     * @param id block id
+     */
+    void free(uint32_t id) {
+        assert(id < next_block_id);
+        dirty_nodes.erase(id);
+        release_slot(id);
+        free_ids.push_back(id);
+    }
+
     /**
      * Mark a block as dirty
      * @param id block id
@@ -220,7 +348,7 @@ public:
     void mark_dirty(uint32_t id) {
 //        assert(cache.contains(id));
         dirty_nodes.insert(id);
-        ctr_mark_dirty++;
+        metrics::add(metrics::event::MARK_DIRTY);
     }
 
     /**
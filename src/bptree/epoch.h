@@ -0,0 +1,181 @@
+#ifndef EPOCH_H
+#define EPOCH_H
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <deque>
+#include <limits>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/**
+ * Epoch-based reclamation of block ids. A reader pins the current global epoch for the duration of an operation; a
+ * block that is no longer reachable is retired with the epoch of its removal, and its id only goes back to the block
+ * manager once every pinned thread has moved past that epoch, so no reader can still hold it through open_block().
+ *
+ * Pinning is a store and a fence on a cache-line of the reading thread, readers never take a lock. The registry lock
+ * is only taken when a thread pins for the first time or exits, and by reclaimers scanning the pinned epochs.
+ */
+namespace epoch {
+    static constexpr uint64_t QUIESCENT = std::numeric_limits<uint64_t>::max();
+    static constexpr size_t CACHE_LINE = 64;
+
+    struct alignas(CACHE_LINE) thread_epoch {
+        std::atomic<uint64_t> pinned{QUIESCENT};
+        uint32_t depth = 0;  // nested guards, only touched by the owner thread
+    };
+
+    class registry {
+        std::mutex lock;
+        std::vector<thread_epoch *> threads;
+        std::atomic<uint64_t> global{1};
+
+    public:
+        static registry &instance() {
+            static registry r;
+            return r;
+        }
+
+        void enroll(thread_epoch *e) {
+            std::lock_guard guard(lock);
+            threads.push_back(e);
+        }
+
+        void retire(thread_epoch *e) {
+            std::lock_guard guard(lock);
+            threads.erase(std::find(threads.begin(), threads.end(), e));
+        }
+
+        [[nodiscard]] uint64_t current() const { return global.load(std::memory_order_seq_cst); }
+
+        /**
+         * Move the global epoch forward if every pinned thread has seen the current one
+         * @return oldest epoch still pinned, or the global epoch when no thread is pinned
+         */
+        uint64_t advance() {
+            std::lock_guard guard(lock);
+            uint64_t now = global.load(std::memory_order_seq_cst);
+            uint64_t oldest = QUIESCENT;
+            for (const thread_epoch *e: threads) oldest = std::min(oldest, e->pinned.load(std::memory_order_seq_cst));
+            if (oldest >= now) {
+                global.compare_exchange_strong(now, now + 1, std::memory_order_seq_cst);
+                oldest = std::min(oldest, now + 1);
+            }
+            return oldest;
+        }
+    };
+
+    struct thread_slot {
+        thread_epoch epoch;
+
+        thread_slot() { registry::instance().enroll(&epoch); }
+
+        ~thread_slot() { registry::instance().retire(&epoch); }
+    };
+
+    inline thread_epoch &local() {
+        static thread_local thread_epoch *cached = nullptr;
+        if (__builtin_expect(cached == nullptr, 0)) {
+            static thread_local thread_slot slot;
+            cached = &slot.epoch;
+        }
+        return *cached;
+    }
+
+    /**
+     * Pins the calling thread for its lifetime; guards nest
+     */
+    class guard {
+        thread_epoch &e;
+
+    public:
+        guard() : e(local()) {
+            if (e.depth++ == 0) {
+                e.pinned.store(registry::instance().current(), std::memory_order_relaxed);
+                // the pin must be visible before the first block is read
+                std::atomic_thread_fence(std::memory_order_seq_cst);
+            }
+        }
+
+        guard(const guard &) = delete;
+
+        guard &operator=(const guard &) = delete;
+
+        ~guard() {
+            if (--e.depth == 0) e.pinned.store(QUIESCENT, std::memory_order_release);
+        }
+    };
+
+    /**
+     * Deferred free list of one writer. Retired ids are kept in retire order, which is also epoch order, and handed to
+     * release in batches once no reader can hold them. The list never grows past MAX_DEFERRED ids: a writer that
+     * reaches it waits for the readers to move on.
+     *
+     * @tparam release_f callable taking a block id
+     */
+    template<typename release_f>
+    class reclaimer {
+        static constexpr size_t BATCH = 64;
+        static constexpr size_t MAX_DEFERRED = 1 << 16;
+
+        struct retired {
+            uint64_t epoch;
+            uint32_t id;
+        };
+
+        release_f release;
+        std::deque<retired> limbo;
+        size_t since_collect;
+
+    public:
+        explicit reclaimer(release_f release) : release(std::move(release)), since_collect(0) {}
+
+        reclaimer(const reclaimer &) = delete;
+
+        reclaimer &operator=(const reclaimer &) = delete;
+
+        /**
+         * Must be called from a single thread, after the block has been made unreachable
+         * @param id block id
+         */
+        void retire(uint32_t id) {
+            // order the unlinking before the epoch the block is tagged with
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            limbo.push_back({registry::instance().current(), id});
+            if (++since_collect >= BATCH) collect();
+            // a thread pinned itself would wait forever
+            while (limbo.size() >= MAX_DEFERRED && local().depth == 0) {
+                std::this_thread::yield();
+                collect();
+            }
+        }
+
+        /**
+         * Release the ids that no pinned thread can still hold
+         */
+        void collect() {
+            since_collect = 0;
+            const uint64_t oldest = registry::instance().advance();
+            while (!limbo.empty() && limbo.front().epoch < oldest) {
+                release(limbo.front().id);
+                limbo.pop_front();
+            }
+        }
+
+        /**
+         * Wait for the readers and release every retired id
+         */
+        void drain() {
+            while (!limbo.empty()) {
+                collect();
+                if (!limbo.empty()) std::this_thread::yield();
+            }
+        }
+
+        [[nodiscard]] size_t deferred() const { return limbo.size(); }
+    };
+}
+
+#endif
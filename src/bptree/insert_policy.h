@@ -0,0 +1,122 @@
+#ifndef INSERT_POLICY_H
+#define INSERT_POLICY_H
+
+#include <cstdint>
+#include <string>
+
+/**
+ * Compile-time description of an insertion strategy. Each flag replaces one of the old preprocessor switches
+ * (TAIL_FAT, LIL_FAT, LOL_FAT, VARIABLE_SPLIT, REDISTRIBUTE, LOL_RESET) so that every strategy can be instantiated
+ * in the same binary.
+ */
+template<bool TAIL_FAT, bool LIL_FAT, bool LOL_FAT, bool VARIABLE_SPLIT, bool REDISTRIBUTE, bool LOL_RESET>
+struct insert_policy {
+    static constexpr bool tail_fat = TAIL_FAT;
+    static constexpr bool lil_fat = LIL_FAT;
+    static constexpr bool lol_fat = LOL_FAT;
+    static constexpr bool variable_split = VARIABLE_SPLIT;
+    static constexpr bool redistribute = REDISTRIBUTE;
+    static constexpr bool lol_reset = LOL_RESET;
+    static constexpr bool fast_path = TAIL_FAT || LIL_FAT || LOL_FAT;
+    static constexpr bool adaptive = false;
+    static constexpr uint8_t fast_paths = 1;
+
+    static_assert(TAIL_FAT + LIL_FAT + LOL_FAT <= 1, "only one fast path can be enabled");
+    static_assert(LOL_FAT || !(VARIABLE_SPLIT || REDISTRIBUTE || LOL_RESET), "lol extensions require lol");
+};
+
+struct simple_policy : insert_policy<false, false, false, false, false, false> {
+    static constexpr const char *name = "SIMPLE";
+};
+
+struct tail_policy : insert_policy<true, false, false, false, false, false> {
+    static constexpr const char *name = "TAIL";
+};
+
+struct lil_policy : insert_policy<false, true, false, false, false, false> {
+    static constexpr const char *name = "LIL";
+};
+
+struct lol_policy : insert_policy<false, false, true, false, false, false> {
+    static constexpr const char *name = "LOL";
+};
+
+struct lol_r_policy : insert_policy<false, false, true, false, false, true> {
+    static constexpr const char *name = "LOL_RESET";
+};
+
+struct lol_v_policy : insert_policy<false, false, true, true, false, false> {
+    static constexpr const char *name = "LOL_VARIABLE";
+};
+
+struct lol_vr_policy : insert_policy<false, false, true, true, true, false> {
+    static constexpr const char *name = "LOL_REDISTRIBUTE_VARIABLE";
+};
+
+struct quit_policy : insert_policy<false, false, true, true, true, true> {
+    static constexpr const char *name = "QUIT";
+};
+
+/**
+ * QuIT with K fast paths for inputs made of several interleaved sorted streams. Each fast path keeps its own IKR state
+ * and the least recently used one is replaced on a hard reset.
+ */
+template<uint8_t K>
+struct multi_quit_policy : insert_policy<false, false, true, true, true, true> {
+    static constexpr uint8_t fast_paths = K;
+    static constexpr const char *name = "QUIT_MULTI";
+
+    static_assert(K >= 1, "at least one fast path is needed");
+};
+
+/**
+ * Strategies the adaptive policy switches between while the tree is running.
+ */
+enum class strategy_mode : uint8_t {
+    SIMPLE, TAIL, LIL, QUIT
+};
+
+/**
+ * The flags describe every feature the tree may need (those of QuIT); the strategy in use is picked at runtime by
+ * the adaptive controller.
+ */
+struct adaptive_policy : insert_policy<false, false, true, true, true, true> {
+    static constexpr bool adaptive = true;
+    static constexpr const char *name = "ADAPTIVE";
+};
+
+/**
+ * Runtime factory: maps a strategy name (simple, tail, lil, lol, lol_r, lol_v, lol_vr, quit, quit_multi,
+ * adaptive) to its policy type and invokes f with a value of that type, so the caller can instantiate
+ * bp_tree<key_type, value_type, policy>.
+ * @return false if the name is unknown
+ */
+template<typename F>
+bool dispatch_policy(const std::string &name, F &&f) {
+    if (name == "simple") {
+        f(simple_policy{});
+    } else if (name == "tail") {
+        f(tail_policy{});
+    } else if (name == "lil") {
+        f(lil_policy{});
+    } else if (name == "lol") {
+        f(lol_policy{});
+    } else if (name == "lol_r") {
+        f(lol_r_policy{});
+    } else if (name == "lol_v") {
+        f(lol_v_policy{});
+    } else if (name == "lol_vr") {
+        f(lol_vr_policy{});
+    } else if (name == "quit") {
+        f(quit_policy{});
+    } else if (name == "quit_multi") {
+        f(multi_quit_policy<16>{});
+    } else if (name == "adaptive") {
+        f(adaptive_policy{});
+    } else {
+        return false;
+    }
+    return true;
+}
+
+#endif
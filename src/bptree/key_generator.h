@@ -0,0 +1,310 @@
+#ifndef KEY_GENERATOR_H
+#define KEY_GENERATOR_H
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <limits>
+#include <memory>
+#include <random>
+#include <sstream>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+/**
+ * Produces the keys of a synthetic ingestion workload in insert order, a chunk at a time, so that the workload never
+ * has to be materialized. The same seed always produces the same keys, and reset() starts the sequence over.
+ */
+template<typename key_type>
+class key_generator {
+protected:
+    const size_t count;
+    const unsigned seed;
+    std::mt19937_64 rng;
+    size_t produced;
+
+    virtual key_type generate() = 0;
+
+    virtual void restart() {}
+
+public:
+    key_generator(size_t count, unsigned seed) : count(count), seed(seed), rng(seed), produced(0) {}
+
+    virtual ~key_generator() = default;
+
+    [[nodiscard]] size_t size() const { return count; }
+
+    /**
+     * @param out buffer for at least max keys
+     * @param max
+     * @return number of keys written, 0 once all keys are produced
+     */
+    size_t next(key_type *out, size_t max) {
+        size_t n = std::min(max, count - produced);
+        for (size_t i = 0; i < n; ++i) out[i] = generate();
+        produced += n;
+        return n;
+    }
+
+    void reset() {
+        rng.seed(seed);
+        produced = 0;
+        restart();
+    }
+};
+
+/**
+ * The sortedness model of BoDS: keys 0..N-1 in order, except that K% of the entries are out of order, each displaced
+ * by at most L% of N. Entries leave their position by swapping with a later one; the key waiting for its new
+ * position is remembered until the sequence reaches it, so memory stays proportional to the swaps in flight.
+ */
+template<typename key_type>
+class sortedness_generator : public key_generator<key_type> {
+    const double k;
+    const size_t l;
+    size_t pos;
+    std::unordered_map<size_t, key_type> pending;  // position -> key swapped into it
+
+    key_type generate() override {
+        size_t p = pos++;
+        auto it = pending.find(p);
+        if (it != pending.end()) {
+            key_type key = it->second;
+            pending.erase(it);
+            return key;
+        }
+        // every swap moves two entries
+        std::uniform_real_distribution<double> coin(0, 200);
+        if (coin(this->rng) < k) {
+            std::uniform_int_distribution<size_t> displacement(1, l);
+            size_t q = p + displacement(this->rng);
+            if (q < this->count && pending.emplace(q, p).second) return q;
+        }
+        return p;
+    }
+
+    void restart() override {
+        pos = 0;
+        pending.clear();
+    }
+
+public:
+    /**
+     * @param k percentage of out of order entries
+     * @param l maximum displacement, as a percentage of count
+     */
+    sortedness_generator(size_t count, unsigned seed, double k, double l) :
+            key_generator<key_type>(count, seed),
+            k(k),
+            l(std::max<size_t>(1, l / 100 * count)),
+            pos(0) {}
+};
+
+/**
+ * Zipfian ranks in 1..N, rank r drawn with probability proportional to 1 / r^theta. Sampling uses rejection-inversion
+ * (Hoermann and Derflinger, 1996), which needs constant time and memory for any N; N can change between samples.
+ */
+class zipf_distribution {
+    const double s;
+    const double h_integral_x1;
+    const double s_n;
+    uint64_t n;
+    double h_integral_n;
+
+    static double helper1(double x) {
+        return std::abs(x) > 1e-8 ? std::log1p(x) / x : 1 - x * (.5 - x * (1. / 3 - .25 * x));
+    }
+
+    static double helper2(double x) {
+        return std::abs(x) > 1e-8 ? std::expm1(x) / x : 1 + x * .5 * (1 + x * (1. / 3) * (1 + .25 * x));
+    }
+
+    [[nodiscard]] double h(double x) const { return std::exp(-s * std::log(x)); }
+
+    [[nodiscard]] double h_integral(double x) const {
+        double log_x = std::log(x);
+        return helper2((1 - s) * log_x) * log_x;
+    }
+
+    [[nodiscard]] double h_integral_inverse(double x) const {
+        double t = std::max(-1.0, x * (1 - s));
+        return std::exp(helper1(t) * x);
+    }
+
+public:
+    /**
+     * @param n number of ranks
+     * @param theta skew, 0 is uniform
+     */
+    zipf_distribution(uint64_t n, double theta) :
+            s(theta),
+            h_integral_x1(h_integral(1.5) - 1),
+            s_n(2 - h_integral_inverse(h_integral(2.5) - h(2))),
+            n(0),
+            h_integral_n(0) {
+        resize(n);
+    }
+
+    [[nodiscard]] uint64_t size() const { return n; }
+
+    void resize(uint64_t ranks) {
+        n = std::max<uint64_t>(1, ranks);
+        h_integral_n = h_integral(n + .5);
+    }
+
+    template<typename rng_t>
+    uint64_t operator()(rng_t &rng) const {
+        std::uniform_real_distribution<double> uniform(0, 1);
+        while (true) {
+            double u = h_integral_n + uniform(rng) * (h_integral_x1 - h_integral_n);
+            double x = h_integral_inverse(u);
+            auto rank = std::clamp<uint64_t>(x + .5, 1, n);
+            if (rank - x <= s_n || u >= h_integral(rank + .5) - h(rank)) return rank;
+        }
+    }
+};
+
+/**
+ * Spread ranks over a domain of count values, so that the popular ranks are not also the smallest values
+ * @param rank in 1..count
+ */
+inline uint64_t scatter_rank(uint64_t rank, uint64_t count) {
+    // prime, coprime with any domain smaller than itself
+    static constexpr uint64_t SCATTER = 2654435761u;
+    return (rank - 1) * SCATTER % count;
+}
+
+/**
+ * Keys drawn from a Zipfian distribution over a domain of N keys, with the popular ranks scattered over the domain
+ */
+template<typename key_type>
+class zipf_generator : public key_generator<key_type> {
+    const zipf_distribution zipf;
+
+    key_type generate() override { return scatter_rank(zipf(this->rng), this->count); }
+
+public:
+    /**
+     * @param theta skew, 0 is uniform
+     */
+    zipf_generator(size_t count, unsigned seed, double theta) :
+            key_generator<key_type>(count, seed), zipf(count, theta) {}
+};
+
+/**
+ * S sorted streams over disjoint key ranges, interleaved at random, like several sources each appending in order.
+ */
+template<typename key_type>
+class streams_generator : public key_generator<key_type> {
+    std::vector<key_type> next_key;
+    std::vector<key_type> end_key;
+
+    key_type generate() override {
+        std::uniform_int_distribution<size_t> pick(0, next_key.size() - 1);
+        size_t stream = pick(this->rng);
+        while (next_key[stream] == end_key[stream]) stream = (stream + 1) % next_key.size();
+        return next_key[stream]++;
+    }
+
+    void restart() override {
+        for (size_t i = 0; i < next_key.size(); ++i) next_key[i] = i * this->count / next_key.size();
+    }
+
+public:
+    streams_generator(size_t count, unsigned seed, size_t streams) :
+            key_generator<key_type>(count, seed),
+            next_key(std::max<size_t>(1, streams)),
+            end_key(next_key.size()) {
+        for (size_t i = 0; i < end_key.size(); ++i) end_key[i] = (i + 1) * count / end_key.size();
+        restart();
+    }
+};
+
+/**
+ * Increasing timestamps that arrive in bursts: runs of consecutive keys, of B keys on average, separated by quiet
+ * periods of as many keys whose gaps are up to G. G is lowered when needed so that twice the expected span of the keys
+ * fits key_type, the keys never wrap around.
+ */
+template<typename key_type>
+class burst_generator : public key_generator<key_type> {
+    const double mean_run;
+    const key_type max_gap;
+    key_type key;
+    size_t left;
+    bool burst;
+
+    key_type generate() override {
+        if (left == 0) {
+            burst = !burst;
+            std::geometric_distribution<size_t> run(1 / mean_run);
+            left = run(this->rng) + 1;
+        }
+        --left;
+        if (burst) return key++;
+        std::uniform_int_distribution<key_type> gap(1, max_gap);
+        // key is one past the last key returned
+        key += gap(this->rng) - 1;
+        return key++;
+    }
+
+    void restart() override {
+        key = 0;
+        left = 0;
+        burst = false;
+    }
+
+public:
+    /**
+     * @return the largest gap up to max_gap for which twice the expected span of count keys fits key_type, 0 if none
+     */
+    static key_type fitting_gap(size_t count, double max_gap) {
+        // half the keys step by 1 in bursts, the other half by (G + 1) / 2 on average
+        const double room = 2 * (static_cast<double>(std::numeric_limits<key_type>::max()) / count - 1) - 1;
+        return std::max(0.0, std::floor(std::min(max_gap, room)));
+    }
+
+    burst_generator(size_t count, unsigned seed, double mean_run, double max_gap) :
+            key_generator<key_type>(count, seed),
+            mean_run(std::max(1.0, mean_run)),
+            max_gap(std::max<key_type>(1, fitting_gap(count, max_gap))),
+            key(0),
+            left(0),
+            burst(false) {}
+};
+
+/**
+ * Build a generator from a spec of the form pattern:N[:param...]
+ * - kl:N:K:L near-sorted keys with K% out of order entries displaced by at most L% of N (defaults 5 and 100)
+ * - zipf:N:THETA Zipfian keys over N values (default 0.99)
+ * - streams:N:S S interleaved sorted streams (default 16)
+ * - burst:N:B:G bursts of B consecutive keys between quiet periods with gaps up to G (defaults 1000 and 1000); G is
+ *   lowered to about 2 * max(key_type) / N so that the keys fit, and N must stay below max(key_type) / 2
+ * @return nullptr if the spec is not valid
+ */
+template<typename key_type>
+std::unique_ptr<key_generator<key_type>> make_key_generator(const std::string &spec, unsigned seed) {
+    std::vector<std::string> parts;
+    std::stringstream ss(spec);
+    for (std::string part; std::getline(ss, part, ':');) parts.push_back(part);
+    static const std::unordered_set<std::string> patterns = {"kl", "zipf", "streams", "burst"};
+    if (parts.size() < 2 || patterns.count(parts[0]) == 0) return nullptr;
+    auto param = [&](size_t i, double fallback) { return i < parts.size() ? std::stod(parts[i]) : fallback; };
+    size_t count = std::stoull(parts[1]);
+    if (count == 0) return nullptr;
+
+    if (parts[0] == "kl") {
+        return std::make_unique<sortedness_generator<key_type>>(count, seed, param(2, 5), param(3, 100));
+    } else if (parts[0] == "zipf") {
+        return std::make_unique<zipf_generator<key_type>>(count, seed, param(2, .99));
+    } else if (parts[0] == "streams") {
+        return std::make_unique<streams_generator<key_type>>(count, seed, param(2, 16));
+    } else if (parts[0] == "burst") {
+        if (burst_generator<key_type>::fitting_gap(count, 1) == 0) return nullptr;
+        return std::make_unique<burst_generator<key_type>>(count, seed, param(2, 1000), param(3, 1000));
+    }
+    return nullptr;
+}
+
+#endif
@@ -0,0 +1,179 @@
+#ifndef LATENCY_HISTOGRAM_H
+#define LATENCY_HISTOGRAM_H
+
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <ostream>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+namespace latency {
+    /**
+     * @return a timestamp in ticks: TSC cycles on x86, nanoseconds elsewhere
+     */
+    inline uint64_t now() {
+#if defined(__x86_64__) || defined(__i386__)
+        return __rdtsc();
+#else
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(
+                std::chrono::steady_clock::now().time_since_epoch()).count();
+#endif
+    }
+
+    /**
+     * Measures the tick rate against the steady clock once per process
+     * @return nanoseconds per tick
+     */
+    inline double ns_per_tick() {
+        static const double ratio = [] {
+#if defined(__x86_64__) || defined(__i386__)
+            auto start = std::chrono::steady_clock::now();
+            uint64_t ticks = now();
+            while (std::chrono::steady_clock::now() - start < std::chrono::milliseconds(20)) {}
+            ticks = now() - ticks;
+            auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                    std::chrono::steady_clock::now() - start).count();
+            return static_cast<double>(ns) / ticks;
+#else
+            return 1.0;
+#endif
+        }();
+        return ratio;
+    }
+}
+
+/**
+ * HDR-style histogram: values are grouped by power of two and every power of two is split in SUB_BUCKETS linear
+ * buckets, so any value is recorded with a relative error below 1 / SUB_BUCKETS in constant memory.
+ */
+class latency_histogram {
+    static constexpr unsigned SUB_BITS = 5;
+    static constexpr uint64_t SUB_BUCKETS = 1 << SUB_BITS;
+    static constexpr unsigned BUCKETS = (64 - SUB_BITS + 1) << SUB_BITS;
+
+    std::array<uint64_t, BUCKETS> buckets;
+    uint64_t count;
+    uint64_t sum;
+    uint64_t max;
+
+    static unsigned index(uint64_t value) {
+        if (value < SUB_BUCKETS) return value;
+        unsigned exp = 63 - __builtin_clzll(value);
+        return ((exp - SUB_BITS + 1) << SUB_BITS) + ((value >> (exp - SUB_BITS)) & (SUB_BUCKETS - 1));
+    }
+
+    static uint64_t lowest(unsigned idx) {
+        if (idx < SUB_BUCKETS) return idx;
+        unsigned exp = (idx >> SUB_BITS) + SUB_BITS - 1;
+        return (SUB_BUCKETS + (idx & (SUB_BUCKETS - 1))) << (exp - SUB_BITS);
+    }
+
+public:
+    latency_histogram() { reset(); }
+
+    void reset() {
+        buckets.fill(0);
+        count = 0;
+        sum = 0;
+        max = 0;
+    }
+
+    void record(uint64_t value) {
+        ++buckets[index(value)];
+        ++count;
+        sum += value;
+        if (value > max) max = value;
+    }
+
+    /**
+     * Add the values recorded by another histogram
+     */
+    void merge(const latency_histogram &other) {
+        for (unsigned i = 0; i < BUCKETS; ++i) buckets[i] += other.buckets[i];
+        count += other.count;
+        sum += other.sum;
+        max = std::max(max, other.max);
+    }
+
+    [[nodiscard]] uint64_t size() const { return count; }
+
+    [[nodiscard]] double mean() const { return count ? static_cast<double>(sum) / count : 0; }
+
+    [[nodiscard]] uint64_t maximum() const { return max; }
+
+    /**
+     * @param q quantile in [0, 1]
+     * @return the middle of the bucket holding the q-quantile, never above the largest recorded value
+     */
+    [[nodiscard]] uint64_t percentile(double q) const {
+        if (count == 0) return 0;
+        uint64_t rank = q * count;
+        if (rank >= count) rank = count - 1;
+        uint64_t seen = 0;
+        for (unsigned i = 0; i < BUCKETS; ++i) {
+            seen += buckets[i];
+            if (seen > rank) {
+                uint64_t low = lowest(i);
+                uint64_t mid = low + (lowest(i + 1) - low) / 2;
+                return mid < max ? mid : max;
+            }
+        }
+        return max;
+    }
+};
+
+/**
+ * Kinds of operations whose latency is reported separately
+ */
+enum class op_kind : uint8_t {
+    INSERT_FAST, INSERT_SLOW, SPLIT, REDISTRIBUTE, LOOKUP, RANGE, COUNT
+};
+
+/**
+ * One histogram per op_kind for the phase being measured
+ */
+class latency_report {
+    static constexpr const char *NAMES[] = {"insert_fast", "insert_slow", "split", "redistribute", "lookup", "range"};
+
+    std::array<latency_histogram, static_cast<size_t>(op_kind::COUNT)> ops;
+
+public:
+    void reset() {
+        for (auto &op: ops) op.reset();
+    }
+
+    void record(op_kind kind, uint64_t ticks) { ops[static_cast<size_t>(kind)].record(ticks); }
+
+    void merge(const latency_report &other) {
+        for (size_t i = 0; i < ops.size(); ++i) ops[i].merge(other.ops[i]);
+    }
+
+    /**
+     * Write the phase as a JSON object of per-kind statistics in nanoseconds; empty kinds are skipped
+     */
+    void write_json(std::ostream &os) const {
+        const double scale = latency::ns_per_tick();
+        os << '{';
+        bool first = true;
+        for (size_t i = 0; i < ops.size(); ++i) {
+            const latency_histogram &op = ops[i];
+            if (op.size() == 0) continue;
+            if (!first) os << ", ";
+            first = false;
+            os << '"' << NAMES[i] << "\": {\"count\": " << op.size()
+               << ", \"mean\": " << static_cast<uint64_t>(op.mean() * scale)
+               << ", \"p50\": " << static_cast<uint64_t>(op.percentile(.5) * scale)
+               << ", \"p90\": " << static_cast<uint64_t>(op.percentile(.9) * scale)
+               << ", \"p99\": " << static_cast<uint64_t>(op.percentile(.99) * scale)
+               << ", \"p999\": " << static_cast<uint64_t>(op.percentile(.999) * scale)
+               << ", \"max\": " << static_cast<uint64_t>(op.maximum() * scale) << '}';
+        }
+        os << '}';
+    }
+};
+
+#endif
@@ -0,0 +1,110 @@
+#ifndef LEAF_FILTER_H
+#define LEAF_FILTER_H
+
+#include <algorithm>
+#include <cstdint>
+#include <functional>
+#include <vector>
+
+/**
+ * A Bloom filter of the keys of each leaf, indexed by the block id of the leaf and kept in memory next to the tree.
+ * A lookup that ends in a leaf whose filter rules the key out is answered without reading the leaf: a block read
+ * saved on disk, a cache miss in memory. Filters only grow; a leaf that loses keys to a split or a redistribution is
+ * refiltered from the keys it keeps. The root is a leaf until the first split but its id may come from the tier of the
+ * internal nodes, so it gets a slot of its own.
+ *
+ * BITS_PER_KEY bits per key of a full leaf with HASHES probes give about 2% false positives on full leaves, fewer on
+ * the others.
+ */
+template<typename key_type>
+class leaf_filter {
+    static constexpr uint32_t BITS_PER_KEY = 8;
+    static constexpr uint32_t HASHES = 4;
+
+    const uint32_t words;  // per leaf
+    const uint32_t bits;
+    const uint32_t root;
+    std::vector<uint64_t> table;
+
+    [[nodiscard]] size_t slot(uint32_t id) const { return id == root ? 0 : static_cast<size_t>(id) + 1; }
+
+    static uint64_t mix(uint64_t h) {
+        h ^= h >> 33;
+        h *= 0xff51afd7ed558ccdULL;
+        h ^= h >> 33;
+        h *= 0xc4ceb9fe1a85ec53ULL;
+        h ^= h >> 33;
+        return h;
+    }
+
+    uint64_t *block(uint32_t id) {
+        const size_t s = slot(id);
+        if (table.size() < (s + 1) * words) table.resize((s + 1) * words);
+        return table.data() + s * words;
+    }
+
+    /**
+     * Call probe with the HASHES bit positions of key, by double hashing
+     */
+    template<typename probe_f>
+    bool probes(const key_type &key, probe_f &&probe) const {
+        const uint64_t h = mix(std::hash<key_type>{}(key));
+        const auto h1 = static_cast<uint32_t>(h);
+        const auto h2 = static_cast<uint32_t>(h >> 32) | 1;
+        for (uint32_t i = 0; i < HASHES; ++i) {
+            if (!probe((h1 + i * h2) % bits)) return false;
+        }
+        return true;
+    }
+
+public:
+    /**
+     * @param leaf_capacity most keys in a leaf
+     * @param root block id of the root
+     */
+    leaf_filter(uint32_t leaf_capacity, uint32_t root) :
+            words((leaf_capacity * BITS_PER_KEY + 63) / 64), bits(words * 64), root(root) {}
+
+    void add(uint32_t id, const key_type &key) {
+        uint64_t *b = block(id);
+        probes(key, [b](uint32_t bit) {
+            b[bit / 64] |= uint64_t(1) << (bit % 64);
+            return true;
+        });
+    }
+
+    /**
+     * @return false if the leaf surely does not hold key
+     */
+    [[nodiscard]] bool may_contain(uint32_t id, const key_type &key) const {
+        const size_t s = slot(id);
+        if (table.size() < (s + 1) * words) return false;
+        const uint64_t *b = table.data() + s * words;
+        return probes(key, [b](uint32_t bit) { return (b[bit / 64] >> (bit % 64)) & 1; });
+    }
+
+    /**
+     * Replace the filter of a leaf with one of its current keys
+     */
+    void rebuild(uint32_t id, const key_type *keys, uint16_t size) {
+        std::fill_n(block(id), words, 0);
+        for (uint16_t i = 0; i < size; ++i) add(id, keys[i]);
+    }
+
+    /**
+     * The leaf moved to another block
+     */
+    void move(uint32_t from, uint32_t to) {
+        block(slot(from) < slot(to) ? to : from);
+        std::copy_n(table.data() + slot(from) * words, words, table.data() + slot(to) * words);
+    }
+
+    void clear() { table.clear(); }
+
+    /**
+     * @return bytes held by the filters
+     */
+    [[nodiscard]] size_t memory() const { return table.size() * sizeof(uint64_t); }
+};
+
+#endif
@@ -0,0 +1,183 @@
+#ifndef LEAF_ROUTER_H
+#define LEAF_ROUTER_H
+
+#include <algorithm>
+#include <cstdint>
+#include <limits>
+#include <vector>
+
+/**
+ * Learned routing from keys to leaves in the style of FITing-Tree. The lower bounds of the leaves, in key order, are
+ * cut into segments whose bounds lie within ERROR positions of a line, so a lookup is a search among the segments and
+ * a binary search in a small window of one segment instead of a descent through the internal nodes. Each segment
+ * keeps its own entries, so a leaf split only shifts the entries of one segment.
+ *
+ * The router mirrors the tree exactly: leaf splits and moved separators are applied as they happen, and anything else
+ * that changes the internal nodes invalidates it until the tree rebuilds it. The path of a leaf only changes when an
+ * internal node splits, so every leaf keeps the index of its parent's path.
+ */
+template<typename key_type, typename node_id_t, typename path_t>
+class leaf_router {
+public:
+    static constexpr size_t ERROR = 32;
+    static constexpr size_t MAX_SEGMENT = 4096;
+
+    struct position {
+        uint32_t segment;
+        uint32_t index;
+    };
+
+private:
+    struct entry {
+        key_type bound;  // lower bound of the leaf, lowest() for the head
+        node_id_t leaf;
+        uint32_t parent;  // index in paths
+    };
+
+    struct segment {
+        key_type first;  // bound of the first entry
+        double slope;
+        uint32_t drift;  // entries added since the fit, each moves a prediction by at most one
+        std::vector<entry> entries;
+    };
+
+    std::vector<path_t> paths;  // path of a parent of leaves, from level 1 to the root
+    std::vector<entry> pending;  // entries of a rebuild, until fit()
+    std::vector<segment> segments;
+    bool fitted;
+
+    static double distance(const key_type &from, const key_type &to) {
+        return static_cast<double>(to) - static_cast<double>(from);
+    }
+
+    /**
+     * Cut entries in segments with a shrinking cone
+     */
+    static void cut(const entry *entries, size_t n, std::vector<segment> &out) {
+        for (size_t i = 0; i < n;) {
+            double low = -std::numeric_limits<double>::infinity();
+            double high = std::numeric_limits<double>::infinity();
+            size_t j = i + 1;
+            for (; j < n && j - i < MAX_SEGMENT; ++j) {
+                const double dx = distance(entries[i].bound, entries[j].bound);
+                const auto rise = static_cast<double>(j - i);
+                const double new_low = std::max(low, (rise - ERROR) / dx);
+                const double new_high = std::min(high, (rise + ERROR) / dx);
+                if (new_low > new_high) break;
+                low = new_low;
+                high = new_high;
+            }
+            out.push_back({entries[i].bound, j == i + 1 ? 0 : (low + high) / 2, 0,
+                           std::vector<entry>(entries + i, entries + j)});
+            i = j;
+        }
+    }
+
+    [[nodiscard]] size_t segment_of(const key_type &key) const {
+        return std::upper_bound(segments.begin(), segments.end(), key,
+                                [](const key_type &k, const segment &s) { return k < s.first; }) - segments.begin() - 1;
+    }
+
+    static uint32_t search(const std::vector<entry> &entries, size_t from, size_t to, const key_type &key) {
+        return std::upper_bound(entries.begin() + from, entries.begin() + to, key,
+                                [](const key_type &k, const entry &e) { return k < e.bound; }) - entries.begin() - 1;
+    }
+
+public:
+    leaf_router() : fitted(false) {}
+
+    [[nodiscard]] bool valid() const { return fitted; }
+
+    void invalidate() { fitted = false; }
+
+    /**
+     * Start a rebuild; add_parent() and add_leaf() must then be called in key order, followed by fit()
+     */
+    void clear() {
+        paths.clear();
+        pending.clear();
+        segments.clear();
+        fitted = false;
+    }
+
+    void add_parent(const path_t &path) { paths.push_back(path); }
+
+    /**
+     * @param lower lower bound of the leaf
+     * @param id leaf under the last parent added
+     */
+    void add_leaf(const key_type &lower, node_id_t id) {
+        pending.push_back({lower, id, static_cast<uint32_t>(paths.size() - 1)});
+    }
+
+    void fit() {
+        cut(pending.data(), pending.size(), segments);
+        pending.clear();
+        fitted = true;
+    }
+
+    /**
+     * A leaf split: the new leaf starts at separator and follows the leaf it came from, under the same parent
+     */
+    void split(const key_type &separator, node_id_t id) {
+        const size_t s = segment_of(separator);
+        auto &entries = segments[s].entries;
+        const uint32_t pos = search(entries, 0, entries.size(), separator) + 1;
+        entries.insert(entries.begin() + pos, {separator, id, entries[pos - 1].parent});
+        if (++segments[s].drift > ERROR) {
+            // refit the segment alone
+            std::vector<segment> refit;
+            cut(entries.data(), entries.size(), refit);
+            segments.erase(segments.begin() + s);
+            segments.insert(segments.begin() + s, std::make_move_iterator(refit.begin()),
+                            std::make_move_iterator(refit.end()));
+        }
+    }
+
+    /**
+     * A separator moved between two leaves
+     */
+    void rekey(const key_type &old_key, const key_type &new_key) {
+        segment &s = segments[segment_of(old_key)];
+        const uint32_t pos = search(s.entries, 0, s.entries.size(), old_key);
+        if (s.entries[pos].bound != old_key) {
+            fitted = false;
+            return;
+        }
+        s.entries[pos].bound = new_key;
+        if (pos == 0) s.first = new_key;
+    }
+
+    [[nodiscard]] position find(const key_type &key) const {
+        const auto s = static_cast<uint32_t>(segment_of(key));
+        const segment &seg = segments[s];
+        const auto n = static_cast<double>(seg.entries.size());
+        const double predicted = seg.slope * distance(seg.first, key);
+        const double slack = ERROR + seg.drift + 1;
+        const auto lo = static_cast<size_t>(std::clamp(predicted - slack, 0.0, n - 1));
+        const auto hi = static_cast<size_t>(std::clamp(predicted + slack + 1, 1.0, n));
+        if ((lo > 0 && key < seg.entries[lo].bound) || (hi < seg.entries.size() && !(key < seg.entries[hi].bound))) {
+            return {s, search(seg.entries, 0, seg.entries.size(), key)};
+        }
+        return {s, search(seg.entries, lo, hi, key)};
+    }
+
+    [[nodiscard]] node_id_t leaf(position pos) const { return segments[pos.segment].entries[pos.index].leaf; }
+
+    [[nodiscard]] const path_t &path(position pos) const {
+        return paths[segments[pos.segment].entries[pos.index].parent];
+    }
+
+    /**
+     * @return upper bound of the leaf, the default key for the last leaf as find_leaf() returns
+     */
+    [[nodiscard]] key_type upper(position pos) const {
+        const segment &seg = segments[pos.segment];
+        if (pos.index + 1 < seg.entries.size()) return seg.entries[pos.index + 1].bound;
+        return pos.segment + 1 < segments.size() ? segments[pos.segment + 1].first : key_type();
+    }
+
+    [[nodiscard]] size_t segment_count() const { return segments.size(); }
+};
+
+#endif
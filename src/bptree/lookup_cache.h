@@ -0,0 +1,71 @@
+#ifndef LOOKUP_CACHE_H
+#define LOOKUP_CACHE_H
+
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <memory>
+
+/**
+ * Direct-mapped cache from keys to the leaf a lookup of the key ended in, in front of the descent of bp_tree::get.
+ * Entries hold a leaf id only and are read and written with relaxed atomics, so concurrent readers share the cache
+ * without a lock. A hint may be stale or belong to another key that hashes to the same entry: the tree checks that
+ * the leaf still covers the key before trusting it, so the cache needs no invalidation when keys move between leaves,
+ * only when a block stops being a leaf.
+ */
+template<typename key_type, typename node_id_t>
+class lookup_cache {
+    std::unique_ptr<std::atomic<node_id_t>[]> entries;
+    size_t mask;
+
+    static size_t round_up(size_t n) {
+        size_t p = 1;
+        while (p < n) p <<= 1;
+        return p;
+    }
+
+    [[nodiscard]] std::atomic<node_id_t> &entry(const key_type &key) const {
+        uint64_t h = std::hash<key_type>{}(key);
+        h ^= h >> 33;
+        h *= 0xff51afd7ed558ccdULL;
+        h ^= h >> 33;
+        return entries[h & mask];
+    }
+
+public:
+    static constexpr node_id_t NONE = -1;
+
+    lookup_cache() : mask(0) {}
+
+    /**
+     * Drop every hint and resize
+     * @param size number of entries, rounded up to a power of two, 0 to disable
+     */
+    void resize(size_t size) {
+        if (size == 0) {
+            entries.reset();
+            mask = 0;
+            return;
+        }
+        size = round_up(size);
+        entries = std::make_unique<std::atomic<node_id_t>[]>(size);
+        mask = size - 1;
+        clear();
+    }
+
+    [[nodiscard]] bool enabled() const { return entries != nullptr; }
+
+    void clear() {
+        if (!entries) return;
+        for (size_t i = 0; i <= mask; ++i) entries[i].store(NONE, std::memory_order_relaxed);
+    }
+
+    /**
+     * @return the leaf of the last lookup hashed to the entry of key, NONE if there is none
+     */
+    [[nodiscard]] node_id_t hint(const key_type &key) const { return entry(key).load(std::memory_order_relaxed); }
+
+    void remember(const key_type &key, node_id_t leaf) const { entry(key).store(leaf, std::memory_order_relaxed); }
+};
+
+#endif
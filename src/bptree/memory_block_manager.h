@@ -1,55 +1,117 @@
 #ifndef MEMORY_BLOCK_MANAGER_H
 #define MEMORY_BLOCK_MANAGER_H
 
+#include <algorithm>
 #include <cassert>
 #include <cstring>
-#include <iostream>
-
-#ifndef BLOCK_SIZE_BYTES
-#define BLOCK_SIZE_BYTES 4096
-#endif
-
 #include <cstdint>
+#include <iostream>
+#include <memory>
+#include <vector>
 
-struct Block {
-    uint8_t block_buf[BLOCK_SIZE_BYTES]{};
-};
+#include "block_arena.h"
 
+/**
+ * Blocks held in memory. The capacity is reserved up front as one range, in which a block id is an index: open_block
+ * is a single multiply-add. Past the capacity the store grows in segments of SEGMENT_BLOCKS blocks, and a block id is
+ * split into a segment index and an offset within the segment, one more load through a flat directory. Blocks never
+ * move, so ids and the addresses open_block returns stay valid as the store grows. Freed blocks are kept in a free list
+ * and handed out again before new ids.
+ */
 class InMemoryBlockManager {
     friend std::ostream &operator<<(std::ostream &os, const InMemoryBlockManager &manager) {
         os << ", ";
         return os;
     }
 
-    const uint32_t capacity;
+    static constexpr unsigned SEGMENT_BITS = 16;
+    static constexpr uint32_t SEGMENT_BLOCKS = 1u << SEGMENT_BITS;
+    static constexpr uint32_t MAX_SEGMENTS = 1u << (32 - SEGMENT_BITS);
+
+    const arena_config config;
     uint32_t next_block_id;
-    Block *internal_memory;
+    std::vector<uint32_t> free_ids;
+    // the reservation of the capacity, then one arena per segment grown past it
+    std::vector<std::unique_ptr<block_arena>> arenas;
+    Block *blocks;
+    uint64_t reserved;  // blocks of the first arena
+    uint32_t segments;
+    std::unique_ptr<Block *[]> directory;
+
+    void grow() {
+        if (segments == MAX_SEGMENTS) {
+            std::cerr << "Error: out of block ids" << std::endl;
+            std::abort();
+        }
+        arenas.emplace_back(std::make_unique<block_arena>(SEGMENT_BLOCKS * sizeof(Block), config));
+        directory[segments++] = static_cast<Block *>(arenas.back()->data());
+    }
 
 public:
     static constexpr uint32_t block_size = BLOCK_SIZE_BYTES;
+    // open_block only reads, so several threads may call it at once
+    static constexpr bool concurrent_reads = true;
+    // blocks stay at the address open_block returns for them, so the tree may keep pointers to them
+    static constexpr bool resident_internals = true;
+    static constexpr bool resident_leaves = true;
 
-    InMemoryBlockManager(const char *filepath, const uint32_t capacity) : capacity(capacity) {
+    /**
+     * @param capacity number of blocks to reserve up front, rounded up to whole segments
+     * @param compress unused, blocks are never written out
+     */
+    InMemoryBlockManager(const char *filepath, const uint32_t capacity, const arena_config &config = {},
+                         [[maybe_unused]] bool compress = false) :
+            config(config),
+            next_block_id(0),
+            directory(std::make_unique<Block *[]>(MAX_SEGMENTS)) {
         std::cerr << "IN MEMORY" << std::endl;
-        next_block_id = 0;
-        internal_memory = new Block[capacity];
+        segments = std::max<uint32_t>(1, (static_cast<uint64_t>(capacity) + SEGMENT_BLOCKS - 1) >> SEGMENT_BITS);
+        reserved = static_cast<uint64_t>(segments) * SEGMENT_BLOCKS;
+        arenas.emplace_back(std::make_unique<block_arena>(reserved * sizeof(Block), config));
+        blocks = static_cast<Block *>(arenas.back()->data());
+        for (uint32_t s = 0; s < segments; ++s) directory[s] = blocks + static_cast<uint64_t>(s) * SEGMENT_BLOCKS;
     }
 
-    ~InMemoryBlockManager() { delete[] internal_memory; }
-
     void reset() {
-        // memset(internal_memory, 0, (size_t)next_block_id * block_size);
         next_block_id = 0;
+        free_ids.clear();
     }
 
     /**
-     * Allocate a block id
+     * Number of block ids handed out so far, freed ones included; every live block id is below it
+     * @return one past the highest block id
+     */
+    [[nodiscard]] uint32_t block_count() const { return next_block_id; }
+
+    /**
+     * Allocate a block id, reusing a freed block if there is one
      * @return block id for the new block
      */
     uint32_t allocate() {
-        assert(next_block_id < capacity);
+        if (!free_ids.empty()) {
+            uint32_t id = free_ids.back();
+            free_ids.pop_back();
+            return id;
+        }
+        if (next_block_id >> SEGMENT_BITS == segments) grow();
         return next_block_id++;
     }
 
+    /**
+     * Allocate a block id for an internal node; internal nodes share the blocks of the leaves
+     * @return block id for the new block
+     */
+    uint32_t allocate_internal() { return allocate(); }
+
+    /**
+     * Return a block that is no longer referenced by the tree
+     * @param id block id
+     */
+    void free(uint32_t id) {
+        assert(id < next_block_id);
+        free_ids.push_back(id);
+    }
+
     /**
      * Mark a block as dirty
      * @param id block id
@@ -58,7 +120,8 @@ public:
 
     [[nodiscard]]
     void *open_block(const uint32_t id) const {
-        return internal_memory[id].block_buf;
+        if (id < reserved) return blocks[id].block_buf;
+        return directory[id >> SEGMENT_BITS][id & (SEGMENT_BLOCKS - 1)].block_buf;
     }
 };
 
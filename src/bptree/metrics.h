@@ -0,0 +1,152 @@
+#ifndef METRICS_H
+#define METRICS_H
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <mutex>
+#include <vector>
+
+/**
+ * Hot path counters. Every thread increments its own cache-line aligned block, so increments never contend and never
+ * share a line with another thread; readers sum the blocks on demand. Blocks of exited threads are folded into a
+ * retired total so their counts are not lost.
+ *
+ * Compile with NO_METRICS to remove the counters: add() becomes empty and collect() returns zeros.
+ */
+namespace metrics {
+    enum class event : uint8_t {
+        LOAD, VALUE_SLOT, VALUE_SLOT2, CHILD_SLOT, BLOCK_WRITE, MARK_DIRTY, FILTERED, CACHED, FAST_READ, COUNT
+    };
+
+    static constexpr size_t EVENTS = static_cast<size_t>(event::COUNT);
+    static constexpr size_t CACHE_LINE = 64;
+
+    /**
+     * Totals of all the threads at the time of collect()
+     */
+    struct snapshot {
+        std::array<uint64_t, EVENTS> events{};
+
+        uint64_t operator[](event e) const { return events[static_cast<size_t>(e)]; }
+    };
+
+#ifndef NO_METRICS
+    /**
+     * A value written by a single thread and readable from any thread. Relaxed loads and stores compile to plain
+     * moves, so updates cost the same as on a plain integer.
+     */
+    template<typename T>
+    class gauge {
+        std::atomic<T> value;
+
+    public:
+        gauge(T v = T()) : value(v) {}
+
+        gauge &operator=(T v) {
+            value.store(v, std::memory_order_relaxed);
+            return *this;
+        }
+
+        operator T() const { return value.load(std::memory_order_relaxed); }
+
+        gauge &operator++() {
+            value.store(value.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+            return *this;
+        }
+
+        T operator++(int) {
+            T old = value.load(std::memory_order_relaxed);
+            value.store(old + 1, std::memory_order_relaxed);
+            return old;
+        }
+    };
+
+    struct alignas(CACHE_LINE) thread_counters {
+        std::array<gauge<uint64_t>, EVENTS> events{};
+    };
+
+    class registry {
+        std::mutex lock;
+        std::vector<thread_counters *> threads;
+        std::array<uint64_t, EVENTS> retired{};
+
+    public:
+        static registry &instance() {
+            static registry r;
+            return r;
+        }
+
+        void enroll(thread_counters *counters) {
+            std::lock_guard guard(lock);
+            threads.push_back(counters);
+        }
+
+        void retire(thread_counters *counters) {
+            std::lock_guard guard(lock);
+            for (size_t i = 0; i < EVENTS; ++i) retired[i] += counters->events[i];
+            threads.erase(std::find(threads.begin(), threads.end(), counters));
+        }
+
+        snapshot collect() {
+            std::lock_guard guard(lock);
+            snapshot s;
+            s.events = retired;
+            for (const thread_counters *counters: threads) {
+                for (size_t i = 0; i < EVENTS; ++i) s.events[i] += counters->events[i];
+            }
+            return s;
+        }
+
+        /**
+         * Zero every counter; increments that race with the reset may be lost
+         */
+        void reset() {
+            std::lock_guard guard(lock);
+            retired.fill(0);
+            for (thread_counters *counters: threads) {
+                for (auto &e: counters->events) e = 0;
+            }
+        }
+    };
+
+    struct thread_slot {
+        thread_counters counters;
+
+        thread_slot() { registry::instance().enroll(&counters); }
+
+        ~thread_slot() { registry::instance().retire(&counters); }
+    };
+
+    inline thread_counters &local() {
+        // the raw pointer avoids the guard of the thread_local object on every increment
+        static thread_local thread_counters *cached = nullptr;
+        if (__builtin_expect(cached == nullptr, 0)) {
+            static thread_local thread_slot slot;
+            cached = &slot.counters;
+        }
+        return *cached;
+    }
+
+    inline void add(event e, uint64_t n = 1) {
+        auto &counter = local().events[static_cast<size_t>(e)];
+        counter = counter + n;
+    }
+
+    inline snapshot collect() { return registry::instance().collect(); }
+
+    inline void reset() { registry::instance().reset(); }
+#else
+    template<typename T>
+    using gauge = T;
+
+    inline void add(event, uint64_t = 1) {}
+
+    inline snapshot collect() { return {}; }
+
+    inline void reset() {}
+#endif
+}
+
+#endif
@@ -0,0 +1,85 @@
+#ifndef NODE_VIEWS_H
+#define NODE_VIEWS_H
+
+#include <atomic>
+#include <cassert>
+#include <memory>
+#include <unordered_map>
+
+/**
+ * Cached views of the internal nodes of a tree whose internal nodes stay at one address, with their children
+ * swizzled. The view of a node holds the pointers into its block, built once when the node is created instead of on
+ * every visit. Next to the child ids stored in the block, it keeps one swip per child slot: the id the slot held when
+ * it was last followed and a raw pointer to that child, the view of an internal child or the block of a leaf. A
+ * descent follows the pointer when the id still matches and goes through the id otherwise (as in LeanStore), so splits
+ * and compactions that shift or replace children need no invalidation. The id of a block fixes its address and the
+ * level of a node fixes the kind of its children, so a matching id always points at the right child; only a node
+ * that is created anew, or the root when it moves up a level, starts over with no child swizzled.
+ *
+ * Views are created by the thread that changes the tree. Readers only fill in swips, with atomics, so several of
+ * them may descend at once.
+ */
+template<typename node_t, typename node_id_t>
+class node_views {
+    struct swip {
+        std::atomic<node_id_t> id;
+        std::atomic<void *> ptr;
+    };
+
+public:
+    static constexpr node_id_t NONE = -1;
+
+    struct view {
+        node_t node;
+        std::unique_ptr<swip[]> swips;  // one per child slot
+    };
+
+private:
+    std::unordered_map<node_id_t, std::unique_ptr<view>> views;
+
+public:
+    /**
+     * The block of id holds a new internal node: point its view at the block and unswizzle all of its children
+     * @param block the block of id, which may not be initialized yet
+     */
+    view *reset(node_id_t id, void *block) {
+        auto &v = views[id];
+        if (!v) {
+            v = std::make_unique<view>();
+            v->swips = std::make_unique<swip[]>(node_t::internal_capacity + 1);
+        }
+        v->node.bind_internal(block);
+        for (uint16_t i = 0; i <= node_t::internal_capacity; ++i) {
+            v->swips[i].id.store(NONE, std::memory_order_relaxed);
+        }
+        return v.get();
+    }
+
+    /**
+     * @return the view of an internal node
+     */
+    [[nodiscard]] view *find(node_id_t id) const {
+        auto it = views.find(id);
+        assert(it != views.end());
+        return it->second.get();
+    }
+
+    /**
+     * Follow the child in slot of an internal node, swizzling the slot if it does not point at the child yet
+     * @param resolve maps the id of the child to the pointer to keep
+     */
+    template<typename resolve_f>
+    void *follow(const view &parent, uint16_t slot, resolve_f &&resolve) const {
+        const node_id_t id = parent.node.children[slot];
+        swip &s = parent.swips[slot];
+        if (s.id.load(std::memory_order_acquire) == id) return s.ptr.load(std::memory_order_relaxed);
+        void *ptr = resolve(id);
+        s.ptr.store(ptr, std::memory_order_relaxed);
+        s.id.store(id, std::memory_order_release);
+        return ptr;
+    }
+
+    void clear() { views.clear(); }
+};
+
+#endif
@@ -1,7 +1,11 @@
 #ifndef OUTLIER_DETECTOR_H
 #define OUTLIER_DETECTOR_H
 
+#include <algorithm>
+#include <cmath>
 #include <cstdint>
+#include <memory>
+#include <string>
 
 namespace IKR {
     size_t max_distance(size_t dq, uint16_t n1, uint16_t n2) {
@@ -12,9 +16,197 @@ namespace IKR {
         return (dq * .7) * n2 / n1;
     }
 
-    size_t upper_bound(size_t dq, uint16_t n1, uint16_t n2) {
-        return (dq / .7) * n2 / n1;
+    size_t upper_bound(size_t dq, uint16_t n1, uint16_t n2, double slack = 1 / .7) {
+        return dq * slack * n2 / n1;
     }
 }
 
+/**
+ * Decision thresholds of the outlier detectors
+ */
+struct outlier_config {
+    std::string type = "ikr";  // ikr or sketch
+    double quantile = .9;  // sketch: quantile of the key density used as the typical density
+    double slack = 1 / .7;  // tolerance over the typical distance before a key is an outlier
+    uint16_t split_margin = 10;  // variable split: keys kept before the first outlier
+    uint16_t window_leaves = 16;  // sketch: leaves summarized before the sketch is renewed
+    uint16_t sample_keys = 32;  // sketch: keys per density sample
+};
+
+/**
+ * Decides how far the keys of the fast node can reach before they are considered outliers.
+ */
+template<typename key_type>
+class outlier_detector {
+public:
+    virtual ~outlier_detector() = default;
+
+    /**
+     * Called when a leaf stops being the fast node and becomes its previous leaf
+     * @param keys sorted keys of the leaf
+     * @param size number of keys
+     */
+    virtual void observe(const key_type *keys, uint16_t size) = 0;
+
+    /**
+     * @param dq distance covered by the previous leaf
+     * @param n1 size of the previous leaf
+     * @param n2 number of keys to cover
+     * @return maximum distance n2 keys may cover without an outlier
+     */
+    virtual size_t upper_bound(size_t dq, uint16_t n1, uint16_t n2) const = 0;
+
+    /**
+     * @return how many keys before the first outlier the variable split leaves in the next leaf
+     */
+    virtual uint16_t split_margin() const = 0;
+};
+
+/**
+ * The original heuristic, which extrapolates the density of the previous leaf.
+ */
+template<typename key_type>
+class ikr_detector : public outlier_detector<key_type> {
+    const double slack;
+    const uint16_t margin;
+
+public:
+    explicit ikr_detector(const outlier_config &conf) : slack(conf.slack), margin(conf.split_margin) {}
+
+    void observe(const key_type *, uint16_t) override {}
+
+    size_t upper_bound(size_t dq, uint16_t n1, uint16_t n2) const override {
+        return IKR::upper_bound(dq, n1, n2, slack);
+    }
+
+    uint16_t split_margin() const override { return margin; }
+};
+
+/**
+ * P-square streaming quantile estimator (Jain and Chlamtac, 1985): five markers, constant memory and no stored
+ * samples.
+ */
+class p2_quantile {
+    double p;
+    double q[5];  // marker heights
+    double n[5];  // marker positions
+    double np[5];  // desired marker positions
+    double dn[5];  // desired position increments
+    uint32_t count;
+
+    double parabolic(int i, double d) const {
+        return q[i] + d / (n[i + 1] - n[i - 1]) *
+                      ((n[i] - n[i - 1] + d) * (q[i + 1] - q[i]) / (n[i + 1] - n[i]) +
+                       (n[i + 1] - n[i] - d) * (q[i] - q[i - 1]) / (n[i] - n[i - 1]));
+    }
+
+    double linear(int i, int d) const {
+        return q[i] + d * (q[i + d] - q[i]) / (n[i + d] - n[i]);
+    }
+
+public:
+    explicit p2_quantile(double p) : p(p), q(), n(), np(), dn(), count(0) {}
+
+    void reset() { count = 0; }
+
+    [[nodiscard]] uint32_t size() const { return count; }
+
+    void add(double x) {
+        if (count < 5) {
+            q[count++] = x;
+            if (count == 5) {
+                std::sort(q, q + 5);
+                for (int i = 0; i < 5; ++i) n[i] = i;
+                np[0] = 0, np[1] = 2 * p, np[2] = 4 * p, np[3] = 2 + 2 * p, np[4] = 4;
+                dn[0] = 0, dn[1] = p / 2, dn[2] = p, dn[3] = (1 + p) / 2, dn[4] = 1;
+            }
+            return;
+        }
+        ++count;
+
+        int k;
+        if (x < q[0]) {
+            q[0] = x;
+            k = 0;
+        } else if (x >= q[4]) {
+            q[4] = std::max(q[4], x);
+            k = 3;
+        } else {
+            k = 0;
+            while (x >= q[k + 1]) ++k;
+        }
+        for (int i = k + 1; i < 5; ++i) n[i]++;
+        for (int i = 0; i < 5; ++i) np[i] += dn[i];
+
+        for (int i = 1; i < 4; ++i) {
+            double d = np[i] - n[i];
+            if ((d >= 1 && n[i + 1] - n[i] > 1) || (d <= -1 && n[i - 1] - n[i] < -1)) {
+                int s = d > 0 ? 1 : -1;
+                double qp = parabolic(i, s);
+                q[i] = q[i - 1] < qp && qp < q[i + 1] ? qp : linear(i, s);
+                n[i] += s;
+            }
+        }
+    }
+
+    [[nodiscard]] double estimate() const {
+        if (count >= 5) return q[2];
+        if (count == 0) return 0;
+        double sorted[5];
+        std::copy(q, q + count, sorted);
+        std::sort(sorted, sorted + count);
+        return sorted[std::min<uint32_t>(count - 1, p * count)];
+    }
+};
+
+/**
+ * Keeps a quantile sketch of the key density (mean inter-key gap over runs of sample_keys keys) of the last leaves that
+ * left the fast path. IKR extrapolates from the span of the previous leaf only, so one far key in that leaf inflates
+ * the bound; a quantile over many runs of several leaves is not moved by a single run. The sketch is renewed every
+ * window_leaves leaves so it follows shifts in the input; until it has enough samples the IKR bound is used.
+ */
+template<typename key_type>
+class sketch_detector : public outlier_detector<key_type> {
+    static constexpr uint32_t MIN_SAMPLES = 16;
+
+    const outlier_config conf;
+    p2_quantile current;
+    p2_quantile previous;
+    uint16_t leaves;
+
+public:
+    explicit sketch_detector(const outlier_config &conf) :
+            conf(conf), current(conf.quantile), previous(conf.quantile), leaves(0) {}
+
+    void observe(const key_type *keys, uint16_t size) override {
+        for (uint16_t i = conf.sample_keys; i < size; i += conf.sample_keys) {
+            current.add(static_cast<double>(keys[i] - keys[i - conf.sample_keys]) / conf.sample_keys);
+        }
+        if (++leaves >= conf.window_leaves) {
+            previous = current;
+            current.reset();
+            leaves = 0;
+        }
+    }
+
+    size_t upper_bound(size_t dq, uint16_t n1, uint16_t n2) const override {
+        const p2_quantile &sketch = current.size() >= MIN_SAMPLES ? current : previous;
+        if (sketch.size() < MIN_SAMPLES) return IKR::upper_bound(dq, n1, n2, conf.slack);
+        return std::ceil(sketch.estimate() * conf.slack * n2);
+    }
+
+    uint16_t split_margin() const override { return conf.split_margin; }
+};
+
+/**
+ * @return the detector named by conf.type, IKR if the name is unknown
+ */
+template<typename key_type>
+std::unique_ptr<outlier_detector<key_type>> make_outlier_detector(const outlier_config &conf) {
+    if (conf.type == "sketch") {
+        return std::make_unique<sketch_detector<key_type>>(conf);
+    }
+    return std::make_unique<ikr_detector<key_type>>(conf);
+}
+
 #endif
@@ -0,0 +1,54 @@
+#ifndef RANGE_AGGREGATE_H
+#define RANGE_AGGREGATE_H
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+#include <type_traits>
+
+/**
+ * Count, sum, min and max of the values of a key range, folded one leaf at a time over the contiguous values array of
+ * the leaf. Partial results of pieces of a range merge in any order.
+ */
+template<typename value_type>
+struct range_aggregate {
+    using sum_type = std::conditional_t<std::is_floating_point_v<value_type>, double,
+            std::conditional_t<std::is_signed_v<value_type>, int64_t, uint64_t>>;
+
+    uint64_t count = 0;
+    sum_type sum = 0;
+    value_type min = std::numeric_limits<value_type>::max();
+    value_type max = std::numeric_limits<value_type>::lowest();
+    size_t loads = 0;  // leaves read
+
+    /**
+     * The loop carries nothing but the reductions, so the compiler turns it into SIMD code
+     * @param values contiguous values
+     * @param n
+     */
+    void add(const value_type *values, size_t n) {
+        sum_type s = 0;
+        value_type lo = min;
+        value_type hi = max;
+        for (size_t i = 0; i < n; ++i) {
+            s += values[i];
+            lo = std::min(lo, values[i]);
+            hi = std::max(hi, values[i]);
+        }
+        count += n;
+        sum += s;
+        min = lo;
+        max = hi;
+    }
+
+    void merge(const range_aggregate &other) {
+        count += other.count;
+        sum += other.sum;
+        min = std::min(min, other.min);
+        max = std::max(max, other.max);
+        loads += other.loads;
+    }
+};
+
+#endif
@@ -0,0 +1,353 @@
+#ifndef SHARDED_TREE_H
+#define SHARDED_TREE_H
+
+#include <algorithm>
+#include <limits>
+#include <memory>
+#include <optional>
+#include <string>
+#include <vector>
+
+#include "bp_tree.h"
+
+/**
+ * N trees over disjoint key ranges, each with its own block manager and fast path. Routes map ranges of keys to the
+ * shards; a shard may own several ranges. Shards share no state, so inserts that go to different shards can run on
+ * different threads without any latch: a worker owning a set of shards inserts the keys routed to them.
+ *
+ * The routes start from the quantiles of a sample of the keys. Keys above the largest key inserted so far belong to no
+ * leaf yet, so rebalance() can hand that part of the key space to other shards without moving any entry. This is where
+ * appends, such as time-series keys, land. rebalance() only ever splits that part again: the routes below the largest
+ * key never change, so a shard that is hot within the keys already inserted stays hot.
+ */
+template<typename key_type, typename value_type, typename policy = quit_policy>
+class sharded_tree {
+public:
+    using tree_t = bp_tree<key_type, value_type, policy>;
+
+private:
+    // rebalance when a shard got more than SKEW times its share of the inserts since the last rebalance
+    static constexpr double SKEW = 2;
+
+    struct shard {
+        std::unique_ptr<BlockManager> manager;
+        std::unique_ptr<tree_t> tree;
+        uint64_t size_at_rebalance = 0;
+    };
+
+    // keys from start up to the start of the next route go to shard
+    struct route {
+        key_type start;
+        uint32_t shard;
+    };
+
+    std::vector<std::unique_ptr<shard>> shards;
+    std::vector<route> routes;
+    std::optional<key_type> last_frontier;
+    bool appending = false;  // a rebalance has already split a stretch above the largest key
+    uint32_t compacting = 0;  // shard of the next compaction step
+    metrics::gauge<uint32_t> ctr_rebalance;
+
+    static size_t route_of(const std::vector<route> &routes, const key_type &key) {
+        auto it = std::upper_bound(routes.begin(), routes.end(), key,
+                                   [](const key_type &k, const route &r) { return k < r.start; });
+        return it - routes.begin() - 1;
+    }
+
+    /**
+     * Visit the entries of all the shards in key order, one route after the other
+     * @param scan_shard called with a shard, a key and a visitor, scans that shard from the key
+     */
+    template<typename scan_f, typename visitor_f>
+    static size_t scan_routes(const std::vector<route> &routes, const key_type &min_key, scan_f &&scan_shard,
+                              visitor_f &&visit) {
+        size_t loads = 0;
+        bool more = true;
+        const size_t first = route_of(routes, min_key);
+        for (size_t r = first; more && r < routes.size(); ++r) {
+            const bool bounded = r + 1 < routes.size();
+            const key_type end = bounded ? routes[r + 1].start : key_type();
+            loads += scan_shard(routes[r].shard, r == first ? min_key : routes[r].start,
+                                [&](const key_type &key, const value_type &value) {
+                                    if (bounded && !(key < end)) return false;
+                                    return more = visit(key, value);
+                                });
+        }
+        return loads;
+    }
+
+    /**
+     * Merge consecutive routes to the same shard
+     */
+    void compact_routes() {
+        size_t kept = 1;
+        for (size_t r = 1; r < routes.size(); ++r) {
+            if (routes[r].shard != routes[kept - 1].shard) routes[kept++] = routes[r];
+        }
+        routes.resize(kept);
+    }
+
+public:
+    /**
+     * @param filepath prefix of the files of the shards, shard i uses filepath.i
+     * @param capacity blocks of all the shards together
+     * @param count number of shards
+     * @param sample keys that the initial routes split in count ranges of equal size, may be empty
+     */
+    sharded_tree(const std::string &filepath, uint32_t capacity, uint32_t count, std::vector<key_type> sample,
+                 const arena_config &config = {}, bool compress = false, const outlier_config &outliers = {}) {
+        count = std::max<uint32_t>(count, 1);
+        for (uint32_t i = 0; i < count; ++i) {
+            auto s = std::make_unique<shard>();
+            s->manager = std::make_unique<BlockManager>((filepath + "." + std::to_string(i)).c_str(),
+                                                        std::max<uint32_t>(capacity / count, 1), config, compress);
+            s->tree = std::make_unique<tree_t>(*s->manager, outliers);
+            shards.push_back(std::move(s));
+        }
+        routes.push_back({std::numeric_limits<key_type>::lowest(), 0});
+        std::sort(sample.begin(), sample.end());
+        for (uint32_t i = 1; i < count && !sample.empty(); ++i) {
+            const key_type start = sample[sample.size() * i / count];
+            if (routes.back().start < start) routes.push_back({start, i});
+        }
+        ctr_rebalance = 0;
+    }
+
+    [[nodiscard]] size_t size() const { return shards.size(); }
+
+    void learned_routing(bool enabled) {
+        for (auto &s: shards) s->tree->learned_routing(enabled);
+    }
+
+    void leaf_filters(bool enabled) {
+        for (auto &s: shards) s->tree->leaf_filters(enabled);
+    }
+
+    void cache_lookups(size_t entries) {
+        for (auto &s: shards) s->tree->cache_lookups(entries);
+    }
+
+    tree_t &at(size_t i) { return *shards[i]->tree; }
+
+    const tree_t &at(size_t i) const { return *shards[i]->tree; }
+
+    /**
+     * @return the shard that owns key
+     */
+    [[nodiscard]] size_t shard_of(const key_type &key) const { return routes[route_of(routes, key)].shard; }
+
+    /**
+     * Safe to call from several threads as long as no two of them insert into the same shard at the same time
+     */
+    bool insert(const key_type &key, const value_type &value) { return at(shard_of(key)).insert(key, value); }
+
+    /**
+     * Move the routes above the largest key when the largest key grew and either the inserts since the last call went
+     * mostly to a few shards, or the keys are appended and will soon run past the stretch split by the last call. The
+     * next stretch of keys, as long as the growth since the last call, is split evenly over all the shards.
+     * No insert may run during the call.
+     * @return whether the routes changed
+     */
+    bool rebalance() {
+        uint64_t total = 0;
+        uint64_t most = 0;
+        std::optional<key_type> frontier;
+        for (auto &s: shards) {
+            const uint64_t now = s->tree->stats().size;
+            total += now - s->size_at_rebalance;
+            most = std::max(most, now - s->size_at_rebalance);
+            s->size_at_rebalance = now;
+            auto max_key = s->tree->max_key();
+            if (max_key && (!frontier || *frontier < *max_key)) frontier = max_key;
+        }
+        const std::optional<key_type> previous = last_frontier;
+        last_frontier = frontier;
+        if (total == 0 || !frontier || !previous || !(*previous < *frontier)) return false;
+        const key_type growth = *frontier - *previous;
+        const key_type room = std::numeric_limits<key_type>::max() - *frontier;
+        const bool skewed = most * shards.size() >= SKEW * total;
+        const bool running_out = appending && (room < growth || !(*frontier + growth < routes.back().start));
+        if (!skewed && !running_out) return false;
+
+        const key_type stretch = std::min(growth, room);
+        const key_type step = stretch / shards.size();
+        if (step == 0) return false;
+        // the routes above the frontier hold no key yet
+        routes.resize(route_of(routes, *frontier) + 1);
+        for (uint32_t i = 0; i < shards.size(); ++i) {
+            routes.push_back({static_cast<key_type>(*frontier + 1 + i * step), i});
+        }
+        compact_routes();
+        appending = true;
+        ++ctr_rebalance;
+        return true;
+    }
+
+    /**
+     * A compaction step on one shard; the shards are compacted one after the other
+     * @return true when the step finished the last shard
+     */
+    bool compact(size_t budget) {
+        if (!at(compacting).compact(budget)) return false;
+        compacting = (compacting + 1) % shards.size();
+        return compacting == 0;
+    }
+
+    [[nodiscard]] typename tree_t::fill_stats fill() const {
+        typename tree_t::fill_stats sum{};
+        double used = 0;
+        for (const auto &s: shards) {
+            auto f = s->tree->fill();
+            sum.leaves += f.leaves;
+            sum.entries += f.entries;
+            sum.underfull += f.underfull;
+            used += f.fill * f.leaves;
+        }
+        sum.fill = used / sum.leaves;
+        return sum;
+    }
+
+    /**
+     * Visit the entries of all the shards in key order from min_key until visit returns false
+     * @return number of leaves loaded
+     */
+    template<typename visitor_f>
+    size_t scan(const key_type &min_key, visitor_f &&visit) const {
+        return scan_routes(routes, min_key, [this](uint32_t s, const key_type &from, auto &&visitor) {
+            return at(s).scan(from, visitor);
+        }, visit);
+    }
+
+    size_t top_k(size_t count, const key_type &min_key) const {
+        size_t seen = 0;
+        return scan(min_key, [&](const key_type &, const value_type &) { return ++seen < count; });
+    }
+
+    size_t range(const key_type &min_key, const key_type &max_key) const {
+        return scan(min_key, [&](const key_type &key, const value_type &) { return key < max_key; });
+    }
+
+    /**
+     * Aggregate the part of [lo, hi) of each route on its shard
+     */
+    range_aggregate<value_type> aggregate(const key_type &lo, const key_type &hi, unsigned threads = 1) const {
+        range_aggregate<value_type> total;
+        for (size_t r = route_of(routes, lo); r < routes.size() && routes[r].start < hi; ++r) {
+            const key_type from = std::max(lo, routes[r].start);
+            const key_type to = r + 1 < routes.size() ? std::min(hi, routes[r + 1].start) : hi;
+            total.merge(at(routes[r].shard).aggregate(from, to, threads));
+        }
+        return total;
+    }
+
+    std::optional<value_type> get(const key_type &key) const { return at(shard_of(key)).get(key); }
+
+    bool contains(const key_type &key) const { return get(key).has_value(); }
+
+    /**
+     * Sum of the traces of the shards; only meaningful while a single thread inserts
+     */
+    [[nodiscard]] typename tree_t::insert_trace trace() const {
+        typename tree_t::insert_trace sum{};
+        for (const auto &s: shards) {
+            auto t = s->tree->trace();
+            sum.fast_path += t.fast_path;
+            sum.nodes += t.nodes;
+            sum.redistribute += t.redistribute;
+        }
+        return sum;
+    }
+
+    /**
+     * Sums over the shards, the depth is the deepest one
+     */
+    [[nodiscard]] typename tree_t::tree_stats stats() const {
+        typename tree_t::tree_stats sum{};
+        for (const auto &s: shards) {
+            auto t = s->tree->stats();
+            sum.size += t.size;
+            sum.depth = std::max(sum.depth, t.depth);
+            sum.internal += t.internal;
+            sum.leaves += t.leaves;
+            sum.fast_path += t.fast_path;
+            sum.split += t.split;
+            sum.iqr += t.iqr;
+            sum.soft += t.soft;
+            sum.hard += t.hard;
+            sum.redistribute += t.redistribute;
+        }
+        sum.counters = metrics::collect();
+        return sum;
+    }
+
+    [[nodiscard]] uint32_t rebalances() const { return ctr_rebalance; }
+
+    [[nodiscard]] size_t route_count() const { return routes.size(); }
+
+    friend std::ostream &operator<<(std::ostream &os, const sharded_tree &tree) {
+        auto t = tree.stats();
+        // the block manager columns come from the process-wide counters, the same for every shard
+        os << t.size << ", " << +t.depth << ", " << *tree.shards[0]->manager << ", " << t.internal << ", " << t.leaves
+           << ", ";
+        if constexpr (policy::redistribute) os << t.redistribute;
+        os << ", ";
+        if constexpr (policy::lol_fat) os << t.split;
+        os << ", ";
+        if constexpr (policy::lol_fat) os << t.iqr;
+        os << ", ";
+        if constexpr (policy::lol_fat) os << t.soft;
+        os << ", ";
+        if constexpr (policy::lol_reset) os << t.hard;
+        os << ", ";
+        if constexpr (policy::fast_path) os << t.fast_path;
+        os << ", " << t.counters[metrics::event::LOAD] << ", " << t.counters[metrics::event::VALUE_SLOT] << ", "
+           << t.counters[metrics::event::VALUE_SLOT2] << ", " << t.counters[metrics::event::CHILD_SLOT];
+        return os;
+    }
+
+    /**
+     * Snapshots of all the shards together with the routes of the moment
+     */
+    class snapshot_view {
+        std::vector<route> routes;
+        std::vector<typename tree_t::snapshot_view> views;
+
+    public:
+        explicit snapshot_view(sharded_tree &tree) : routes(tree.routes) {
+            views.reserve(tree.shards.size());
+            for (auto &s: tree.shards) views.push_back(s->tree->snapshot());
+        }
+
+        template<typename visitor_f>
+        size_t scan(const key_type &min_key, visitor_f &&visit) const {
+            return scan_routes(routes, min_key, [this](uint32_t s, const key_type &from, auto &&visitor) {
+                return views[s].scan(from, visitor);
+            }, visit);
+        }
+
+        size_t top_k(size_t count, const key_type &min_key) const {
+            size_t seen = 0;
+            return scan(min_key, [&](const key_type &, const value_type &) { return ++seen < count; });
+        }
+
+        size_t range(const key_type &min_key, const key_type &max_key) const {
+            return scan(min_key, [&](const key_type &key, const value_type &) { return key < max_key; });
+        }
+
+        std::optional<value_type> get(const key_type &key) const {
+            return views[routes[route_of(routes, key)].shard].get(key);
+        }
+
+        bool contains(const key_type &key) const { return get(key).has_value(); }
+
+        [[nodiscard]] size_t copies() const {
+            size_t sum = 0;
+            for (const auto &view: views) sum += view.copies();
+            return sum;
+        }
+    };
+
+    snapshot_view snapshot() { return snapshot_view(*this); }
+};
+
+#endif
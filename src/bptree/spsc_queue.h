@@ -0,0 +1,76 @@
+#ifndef SPSC_QUEUE_H
+#define SPSC_QUEUE_H
+
+#include <atomic>
+#include <cstddef>
+#include <vector>
+
+/**
+ * Bounded lock-free queue between one producer thread and one consumer thread. Each side owns its index on a cache line
+ * of its own and keeps a copy of the other side's index, which it only reloads when the queue looks full (or empty), so
+ * the two threads rarely touch the same line.
+ */
+template<typename T>
+class spsc_queue {
+    static constexpr size_t CACHE_LINE = 64;
+
+    std::vector<T> slots;
+    const size_t mask;
+    // consumer side
+    alignas(CACHE_LINE) std::atomic<size_t> head;
+    size_t tail_seen;
+    // producer side
+    alignas(CACHE_LINE) std::atomic<size_t> tail;
+    size_t head_seen;
+
+    static size_t round_up(size_t n) {
+        size_t p = 1;
+        while (p < n) p <<= 1;
+        return p;
+    }
+
+public:
+    /**
+     * @param capacity rounded up to a power of two
+     */
+    explicit spsc_queue(size_t capacity) :
+            slots(round_up(capacity)), mask(slots.size() - 1), head(0), tail_seen(0), tail(0), head_seen(0) {}
+
+    spsc_queue(const spsc_queue &) = delete;
+
+    spsc_queue &operator=(const spsc_queue &) = delete;
+
+    /**
+     * Producer only
+     * @return false if the queue is full
+     */
+    bool try_push(const T &item) {
+        const size_t t = tail.load(std::memory_order_relaxed);
+        if (t - head_seen == slots.size()) {
+            head_seen = head.load(std::memory_order_acquire);
+            if (t - head_seen == slots.size()) return false;
+        }
+        slots[t & mask] = item;
+        tail.store(t + 1, std::memory_order_release);
+        return true;
+    }
+
+    /**
+     * Consumer only
+     * @return false if the queue is empty
+     */
+    bool try_pop(T &item) {
+        const size_t h = head.load(std::memory_order_relaxed);
+        if (h == tail_seen) {
+            tail_seen = tail.load(std::memory_order_acquire);
+            if (h == tail_seen) return false;
+        }
+        item = slots[h & mask];
+        head.store(h + 1, std::memory_order_release);
+        return true;
+    }
+
+    [[nodiscard]] size_t capacity() const { return slots.size(); }
+};
+
+#endif
@@ -0,0 +1,93 @@
+#ifndef TIERED_BLOCK_MANAGER_H
+#define TIERED_BLOCK_MANAGER_H
+
+#include <cstdint>
+#include <iostream>
+
+#include "disk_block_manager.h"
+#include "memory_block_manager.h"
+
+/**
+ * Internal nodes in memory, leaves on disk behind the buffer pool. Internal nodes are a small fraction of the tree
+ * (about one per fanout leaves), so keeping all of them in memory costs little, and a lookup then reads at most one
+ * block from disk: the leaf. The top bit of a block id tells the tiers apart, so routing a block costs one test.
+ */
+class TieredBlockManager {
+    friend std::ostream &operator<<(std::ostream &os, const TieredBlockManager &manager) {
+        os << manager.leaves;
+        return os;
+    }
+
+    static constexpr uint32_t MEMORY_TIER = 1u << 31;
+
+    InMemoryBlockManager internals;
+    DiskBlockManager leaves;
+
+    static bool in_memory(uint32_t id) { return id & MEMORY_TIER; }
+
+public:
+    static constexpr uint32_t block_size = BLOCK_SIZE_BYTES;
+    static constexpr bool concurrent_reads = DiskBlockManager::concurrent_reads;
+    // internal nodes stay in the memory tier, leaves may be evicted
+    static constexpr bool resident_internals = InMemoryBlockManager::resident_internals;
+    static constexpr bool resident_leaves = DiskBlockManager::resident_leaves;
+
+    /**
+     * @param filepath file of the leaves
+     * @param capacity buffer pool size of the leaves, in blocks; the memory tier grows with the internal nodes
+     * @param compress store the leaves compressed on disk
+     */
+    TieredBlockManager(const char *filepath, uint32_t capacity, const arena_config &config = {},
+                       bool compress = false) :
+            internals(filepath, capacity / 16, config),
+            leaves(filepath, capacity, config, compress) {}
+
+    void flush() { leaves.flush(); }
+
+    void reset() {
+        internals.reset();
+        leaves.reset();
+    }
+
+    /**
+     * Allocate a block id for a leaf
+     * @return block id for the new block
+     */
+    uint32_t allocate() {
+        uint32_t id = leaves.allocate();
+        assert(!in_memory(id));
+        return id;
+    }
+
+    /**
+     * Allocate a block id for an internal node
+     * @return block id for the new block
+     */
+    uint32_t allocate_internal() { return internals.allocate() | MEMORY_TIER; }
+
+    /**
+     * Return a block that is no longer referenced by the tree
+     * @param id block id
+     */
+    void free(uint32_t id) {
+        if (in_memory(id)) {
+            internals.free(id & ~MEMORY_TIER);
+        } else {
+            leaves.free(id);
+        }
+    }
+
+    /**
+     * Mark a block as dirty
+     * @param id block id
+     */
+    void mark_dirty(uint32_t id) {
+        if (!in_memory(id)) leaves.mark_dirty(id);
+    }
+
+    void *open_block(uint32_t id) {
+        return in_memory(id) ? internals.open_block(id & ~MEMORY_TIER) : leaves.open_block(id);
+    }
+};
+
+#endif
@@ -0,0 +1,244 @@
+#ifndef WORKLOAD_INPUT_H
+#define WORKLOAD_INPUT_H
+
+#include <algorithm>
+#include <atomic>
+#include <fcntl.h>
+#include <memory>
+#include <random>
+#include <string>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <utility>
+#include <vector>
+
+#include "key_generator.h"
+
+/**
+ * Keys of one workload input, in insert order. The driver reads them in chunks by position and draws the keys of
+ * reads, updates and range queries through pick().
+ */
+template<typename key_type>
+class workload_input {
+    const std::string label;
+
+public:
+    explicit workload_input(std::string label) : label(std::move(label)) {}
+
+    virtual ~workload_input() = default;
+
+    [[nodiscard]] const std::string &name() const { return label; }
+
+    [[nodiscard]] virtual size_t size() const = 0;
+
+    /**
+     * @param pos position of the first key
+     * @param count number of keys, pos + count <= size()
+     * @param buf scratch space for count keys
+     * @return pointer to the keys, either into the input itself or into buf
+     */
+    virtual const key_type *read(size_t pos, size_t count, key_type *buf) = 0;
+
+    /**
+     * @param r random number
+     * @param reserve keys at the end of the input that must not be picked
+     * @return a key of the input chosen by r
+     */
+    [[nodiscard]] virtual key_type pick(size_t r, size_t reserve = 0) const = 0;
+
+    /**
+     * Let pick() draw from the whole input before any key has been read
+     */
+    virtual void fill_sample() {}
+};
+
+/**
+ * An input fully loaded in memory
+ */
+template<typename key_type>
+class vector_input : public workload_input<key_type> {
+    const std::vector<key_type> data;
+
+public:
+    vector_input(std::string label, std::vector<key_type> data) :
+            workload_input<key_type>(std::move(label)), data(std::move(data)) {}
+
+    [[nodiscard]] size_t size() const override { return data.size(); }
+
+    const key_type *read(size_t pos, size_t, key_type *) override { return data.data() + pos; }
+
+    [[nodiscard]] key_type pick(size_t r, size_t reserve) const override { return data[r % (data.size() - reserve)]; }
+};
+
+/**
+ * A read-only mapping of a whole file. Pages are loaded on first access and, being clean, can be dropped by the kernel
+ * under memory pressure, so a mapped input never competes with the buffer pool the way a heap copy does.
+ */
+class mapped_file {
+    char *base;
+    size_t length;
+
+public:
+    /**
+     * @param filename
+     * @param advice madvise hint for the whole mapping
+     */
+    explicit mapped_file(const char *filename, int advice = MADV_SEQUENTIAL) : base(nullptr), length(0) {
+        int fd = open(filename, O_RDONLY);
+        if (fd == -1) return;
+        struct stat st{};
+        if (fstat(fd, &st) == 0 && st.st_size > 0) {
+            void *addr = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+            if (addr != MAP_FAILED) {
+                base = static_cast<char *>(addr);
+                length = st.st_size;
+                madvise(base, length, advice);
+            }
+        }
+        // the mapping keeps the file referenced
+        close(fd);
+    }
+
+    mapped_file(const mapped_file &) = delete;
+
+    mapped_file &operator=(const mapped_file &) = delete;
+
+    ~mapped_file() {
+        if (base != nullptr) munmap(base, length);
+    }
+
+    [[nodiscard]] bool valid() const { return base != nullptr; }
+
+    [[nodiscard]] const char *data() const { return base; }
+
+    [[nodiscard]] size_t size() const { return length; }
+
+    /**
+     * Ask the kernel to start reading a byte range in the background
+     */
+    void will_need(size_t from, size_t bytes) const {
+        static const size_t page = sysconf(_SC_PAGESIZE);
+        if (from >= length) return;
+        from &= ~(page - 1);
+        madvise(base + from, std::min(bytes, length - from), MADV_WILLNEED);
+    }
+};
+
+/**
+ * A binary input of raw keys read in place from a mapped file. The file is advised as sequential, and reads keep a
+ * readahead window of READAHEAD bytes requested ahead of the furthest position read, so workers sharing the input
+ * through a Ticket rarely stall on a page fault. read() never copies and is safe to call from several threads.
+ */
+template<typename key_type>
+class mmap_input : public workload_input<key_type> {
+    static constexpr size_t READAHEAD = 32 << 20;
+
+    const mapped_file file;
+    const key_type *keys;
+    const size_t count;
+    std::atomic<size_t> advised;  // bytes of the file requested so far
+
+public:
+    explicit mmap_input(const char *filename) :
+            workload_input<key_type>(filename),
+            file(filename),
+            keys(reinterpret_cast<const key_type *>(file.data())),
+            count(file.size() / sizeof(key_type)),
+            advised(0) {}
+
+    [[nodiscard]] bool valid() const { return file.valid(); }
+
+    [[nodiscard]] size_t size() const override { return count; }
+
+    const key_type *read(size_t pos, size_t n, key_type *) override {
+        const size_t needed = (pos + n) * sizeof(key_type) + READAHEAD / 2;
+        size_t current = advised.load(std::memory_order_relaxed);
+        if (needed > current && current < file.size()) {
+            // a read far past the window restarts it at the read position
+            size_t from = std::max(current, pos * sizeof(key_type));
+            // only the thread that moves the window issues the hint
+            if (advised.compare_exchange_strong(current, from + READAHEAD, std::memory_order_relaxed)) {
+                file.will_need(from, READAHEAD);
+            }
+        }
+        return keys + pos;
+    }
+
+    [[nodiscard]] key_type pick(size_t r, size_t reserve) const override { return keys[r % (count - reserve)]; }
+};
+
+/**
+ * An input produced by a key_generator while it is read. Reads must move forward; reading an earlier position
+ * replays the generator from the start. pick() draws from a uniform sample of the keys produced in the first pass, each
+ * kept with its position so that the reserved keys at the end of the input are left out.
+ */
+template<typename key_type>
+class generated_input : public workload_input<key_type> {
+    static constexpr size_t SAMPLE_SIZE = 1 << 20;
+
+    std::unique_ptr<key_generator<key_type>> generator;
+    size_t cursor;
+    size_t sampled;
+    struct sampled_key {
+        key_type key;
+        size_t pos;
+    };
+
+    std::vector<sampled_key> sample;
+    std::mt19937_64 rng;
+
+public:
+    generated_input(std::string label, std::unique_ptr<key_generator<key_type>> generator, unsigned seed) :
+            workload_input<key_type>(std::move(label)),
+            generator(std::move(generator)),
+            cursor(0),
+            sampled(0),
+            rng(seed) {}
+
+    [[nodiscard]] size_t size() const override { return generator->size(); }
+
+    const key_type *read(size_t pos, size_t count, key_type *buf) override {
+        if (pos < cursor) {
+            generator->reset();
+            cursor = 0;
+        }
+        while (cursor < pos) cursor += generator->next(buf, std::min(count, pos - cursor));
+        cursor += generator->next(buf, count);
+
+        // reservoir sampling over the first pass
+        if (pos == sampled) {
+            for (size_t i = 0; i < count; ++i, ++sampled) {
+                if (sample.size() < SAMPLE_SIZE) {
+                    sample.push_back({buf[i], sampled});
+                } else {
+                    size_t j = std::uniform_int_distribution<size_t>(0, sampled)(rng);
+                    if (j < SAMPLE_SIZE) sample[j] = {buf[i], sampled};
+                }
+            }
+        }
+        return buf;
+    }
+
+    [[nodiscard]] key_type pick(size_t r, size_t reserve) const override {
+        if (sample.empty()) return key_type();
+        const size_t limit = size() - reserve;
+        // the reserved keys are a small part of the sample, so the next entry before the limit is close by
+        const size_t first = r % sample.size();
+        for (size_t i = first;;) {
+            if (sample[i].pos < limit) return sample[i].key;
+            if (++i == sample.size()) i = 0;
+            if (i == first) return sample[first].key;
+        }
+    }
+
+    /**
+     * Run the first pass now, so that the sample covers every key of the input
+     */
+    void fill_sample() override {
+        std::vector<key_type> buf(std::min<size_t>(SAMPLE_SIZE, size()));
+        while (sampled < size()) read(sampled, std::min(buf.size(), size() - sampled), buf.data());
+    }
+};
+
+#endif
@@ -0,0 +1,360 @@
+#include <chrono>
+#include <cstdio>
+#include <iomanip>
+#include <optional>
+#include <random>
+#include <string>
+#include <unordered_set>
+#include <vector>
+
+#include "bptree/bp_tree.h"
+
+using key_type = unsigned;
+using value_type = unsigned;
+using node_t = bp_node<uint32_t, key_type, value_type>;
+
+/**
+ * Reaches the private primitives of bp_tree so that they can be timed without the rest of an insert
+ */
+struct bp_tree_probe {
+    template<typename tree_t>
+    using path_t = typename tree_t::path_t;
+
+    struct leaf_ref {
+        uint32_t id;
+        key_type min;
+        key_type max;
+        uint16_t size;
+    };
+
+    template<typename tree_t>
+    static std::vector<leaf_ref> leaves(const tree_t &tree) {
+        std::vector<leaf_ref> refs;
+        node_t leaf;
+        uint32_t id = tree.head_id;
+        while (true) {
+            leaf.load(tree.manager.open_block(id));
+            refs.push_back({id, leaf.keys[0], leaf.keys[leaf.info->size - 1], leaf.info->size});
+            if (id == tree.tail_id) return refs;
+            id = leaf.info->next_id;
+        }
+    }
+
+    template<typename tree_t>
+    static uint8_t depth(const tree_t &tree) { return tree.ctr_depth; }
+
+    template<typename tree_t>
+    static uint32_t root(const tree_t &tree) { return tree.root_id; }
+
+    template<typename tree_t>
+    static key_type find_leaf(const tree_t &tree, node_t &leaf, path_t<tree_t> &path, const key_type &key) {
+        return tree.find_leaf(leaf, path, key);
+    }
+
+    template<typename tree_t>
+    static void internal_insert(tree_t &tree, const path_t<tree_t> &path, const key_type &key,
+                                uint32_t child_id) {
+        tree.internal_insert(path, key, child_id, tree_t::SPLIT_INTERNAL_POS);
+    }
+
+    template<typename tree_t>
+    struct fast_path_ref {
+        leaf_ref leaf;
+        leaf_ref prev;
+        path_t<tree_t> path;
+    };
+
+    /**
+     * Make fp.leaf the fast node and fp.prev its previous leaf, as after a soft reset
+     */
+    template<typename tree_t>
+    static void set_fast_path(tree_t &tree, const fast_path_ref<tree_t> &fp) {
+        tree.fp_id = fp.leaf.id;
+        tree.fp_min = fp.leaf.min;
+        tree.fp_path = fp.path;
+        tree.lol_size = fp.leaf.size;
+        tree.lol_prev_id = fp.prev.id;
+        tree.lol_prev_min = fp.prev.min;
+        tree.lol_prev_size = fp.prev.size;
+    }
+
+    template<typename tree_t>
+    static void redistribute(tree_t &tree, const node_t &leaf, const key_type &key) {
+        tree.redistribute(leaf, leaf.value_slot(key), key, 0);
+    }
+
+    template<typename tree_t>
+    static constexpr uint16_t redistribute_threshold() { return tree_t::IQR_SIZE_THRESH; }
+};
+
+namespace {
+    using bench_clock = std::chrono::steady_clock;
+
+    constexpr auto MIN_TIME = std::chrono::milliseconds(200);
+    constexpr uint64_t MAX_ITERATIONS = 1ull << 32;
+    constexpr uint64_t UNLIMITED = ~0ull;
+    constexpr size_t QUERIES = 1 << 12;
+    constexpr uint32_t BLOCKS = 1 << 14;
+    // keys are loaded GAP apart so that every leaf has room for new keys between its own
+    constexpr key_type GAP = 1 << 10;
+    constexpr size_t LOAD_LEAVES = 64;
+    const char *STRATEGIES[] = {"simple", "tail", "lil", "quit"};
+
+    static_assert(GAP > node_t::leaf_capacity, "a leaf must be able to fill up between two loaded keys");
+
+    std::string filter;
+    std::mt19937 generator(1234);
+    BlockManager *manager;
+
+    /**
+     * Keep the compiler from dropping a computation whose result is not used
+     */
+    template<typename T>
+    void keep(const T &value) {
+        asm volatile("" : : "r,m"(value) : "memory");
+    }
+
+    bool selected(const std::string &name) { return name.find(filter) != std::string::npos; }
+
+    /**
+     * Time op the way google benchmark does: the iteration count grows until one run takes MIN_TIME, and the time per
+     * op of that run is reported. setup rebuilds the fixture and is not timed; it returns how many ops the fixture
+     * supports before it has to be rebuilt.
+     */
+    template<typename Setup, typename Op>
+    void run(const std::string &name, Setup &&setup, Op &&op) {
+        if (!selected(name)) return;
+        uint64_t iterations = 1;
+        while (true) {
+            bench_clock::duration elapsed{};
+            uint64_t done = 0;
+            while (done < iterations) {
+                uint64_t batch = std::min<uint64_t>(setup(), iterations - done);
+                assert(batch > 0);
+                auto start = bench_clock::now();
+                for (uint64_t i = 0; i < batch; ++i) op(i);
+                elapsed += bench_clock::now() - start;
+                done += batch;
+            }
+            if (elapsed >= MIN_TIME || iterations >= MAX_ITERATIONS) {
+                double ns = std::chrono::duration<double, std::nano>(elapsed).count() / iterations;
+                std::cout << std::left << std::setw(44) << name << std::right << std::setw(12) << std::fixed
+                          << std::setprecision(1) << ns << " ns" << std::setw(14) << iterations << std::endl;
+                return;
+            }
+            double ratio = std::chrono::duration<double>(MIN_TIME) / std::chrono::duration<double>(elapsed);
+            double multiplier = elapsed * 100 < MIN_TIME ? 10 : std::min(1.4 * ratio, 10.0);
+            iterations = std::max<uint64_t>(iterations + 1, iterations * multiplier);
+        }
+    }
+
+    std::vector<key_type> random_keys(key_type bound) {
+        std::uniform_int_distribution<key_type> distribution(0, bound - 1);
+        std::vector<key_type> keys(QUERIES);
+        for (auto &key: keys) key = distribution(generator);
+        return keys;
+    }
+
+    void node_benchmarks() {
+        alignas(64) static uint8_t block[BlockManager::block_size];
+        for (unsigned fill: {25, 50, 100}) {
+            node_t leaf;
+            leaf.init(block, LEAF);
+            leaf.info->size = node_t::leaf_capacity * fill / 100;
+            for (uint16_t i = 0; i < leaf.info->size; ++i) leaf.keys[i] = 2 * i;
+            auto queries = random_keys(2 * leaf.info->size);
+            run("value_slot/fill:" + std::to_string(fill), [] { return UNLIMITED; },
+                [&](uint64_t i) { keep(leaf.value_slot(queries[i % QUERIES])); });
+        }
+        for (unsigned fill: {25, 50, 100}) {
+            node_t node;
+            node.init(block, INTERNAL);
+            node.info->size = node_t::internal_capacity * fill / 100;
+            for (uint16_t i = 0; i < node.info->size; ++i) node.keys[i] = 2 * i;
+            auto queries = random_keys(2 * node.info->size);
+            run("child_slot/fill:" + std::to_string(fill), [] { return UNLIMITED; },
+                [&](uint64_t i) { keep(node.child_slot(queries[i % QUERIES])); });
+        }
+    }
+
+    template<typename policy>
+    class tree_fixture {
+    public:
+        using tree_t = bp_tree<key_type, value_type, policy>;
+        std::optional<tree_t> tree;
+
+        /**
+         * Start over with a tree holding keys 0, GAP, 2 * GAP, ... inserted in order
+         */
+        void load(size_t count) {
+            tree.reset();
+            manager->reset();
+            tree.emplace(*manager);
+            for (size_t i = 0; i < count; ++i) tree->insert(i * GAP, i);
+        }
+
+        /**
+         * Insert keys right after the largest key of every leaf until it is full
+         */
+        void fill() {
+            for (const auto &leaf: bp_tree_probe::leaves(*tree)) {
+                for (uint16_t i = 1; leaf.size + i <= node_t::leaf_capacity; ++i) tree->insert(leaf.max + i, 0);
+            }
+        }
+    };
+
+    template<typename policy>
+    void tree_benchmarks(const std::string &strategy) {
+        tree_fixture<policy> fixture;
+        using tree_t = typename tree_fixture<policy>::tree_t;
+        const size_t load = LOAD_LEAVES * node_t::leaf_capacity / 2;
+        std::vector<key_type> keys;
+
+        // leaf inserts reached through insert(), so that the routing of the strategy is part of the cost
+        run("leaf_insert/no_split/" + strategy, [&] {
+            fixture.load(load);
+            keys.clear();
+            for (const auto &leaf: bp_tree_probe::leaves(*fixture.tree)) {
+                for (uint16_t i = 1; leaf.size + i <= node_t::leaf_capacity; ++i) keys.push_back(leaf.max + i);
+            }
+            return keys.size();
+        }, [&](uint64_t i) { fixture.tree->insert(keys[i], 0); });
+
+        run("leaf_insert/split/" + strategy, [&] {
+            fixture.load(load);
+            fixture.fill();
+            keys.clear();
+            for (const auto &leaf: bp_tree_probe::leaves(*fixture.tree)) keys.push_back(leaf.max + 1);
+            std::shuffle(keys.begin(), keys.end(), generator);
+            return keys.size();
+        }, [&](uint64_t i) { fixture.tree->insert(keys[i], 0); });
+
+        // separators added to a root with room, so the path never goes stale
+        bp_tree_probe::path_t<tree_t> root_path{};
+        std::vector<uint32_t> children;
+        run("internal_insert/" + strategy, [&] {
+            fixture.load(4 * node_t::leaf_capacity);
+            root_path[1] = bp_tree_probe::root(*fixture.tree);
+            node_t root;
+            root.load(manager->open_block(root_path[1]));
+            size_t room = node_t::internal_capacity - root.info->size;
+            std::unordered_set<key_type> unique;
+            std::uniform_int_distribution<key_type> distribution(1, 4 * node_t::leaf_capacity * GAP);
+            keys.clear();
+            children.clear();
+            while (keys.size() < room) {
+                key_type key = distribution(generator);
+                if (key % GAP == 0 || !unique.insert(key).second) continue;
+                keys.push_back(key);
+                children.push_back(manager->allocate());
+            }
+            return keys.size();
+        }, [&](uint64_t i) { bp_tree_probe::internal_insert(*fixture.tree, root_path, keys[i], children[i]); });
+
+        for (size_t count: {size_t(64), size_t(64) * node_t::leaf_capacity, size_t(1024) * node_t::leaf_capacity}) {
+            // the depth is only known once the tree is built
+            bool any = false;
+            for (uint8_t depth = 1; depth < MAX_DEPTH; ++depth) {
+                any |= selected("find_leaf/depth:" + std::to_string(depth) + "/" + strategy);
+            }
+            if (!any) break;
+            fixture.load(count);
+            auto queries = random_keys(count);
+            for (auto &query: queries) query = query * GAP;
+            node_t leaf;
+            bp_tree_probe::path_t<tree_t> path;
+            run("find_leaf/depth:" + std::to_string(bp_tree_probe::depth(*fixture.tree)) + "/" + strategy,
+                [] { return UNLIMITED; },
+                [&](uint64_t i) { keep(bp_tree_probe::find_leaf(*fixture.tree, leaf, path, queries[i % QUERIES])); });
+        }
+
+        if (policy::redistribute && selected("redistribute/" + strategy)) {
+            // pairs of leaves where the fast node is full and its previous leaf has room; every op turns one pair
+            // into the fast path and redistributes into it, and setup restores the blocks of the tree
+            fixture.load(load);
+            fixture.fill();
+            auto leaves = bp_tree_probe::leaves(*fixture.tree);
+            const uint16_t prev_size = bp_tree_probe::redistribute_threshold<tree_t>() / 2;
+            std::vector<bp_tree_probe::fast_path_ref<tree_t>> pairs;
+            for (size_t i = 1; i + 1 < leaves.size(); i += 2) {
+                bp_tree_probe::fast_path_ref<tree_t> fp{leaves[i], leaves[i - 1], {}};
+                node_t node;
+                node.load(manager->open_block(fp.prev.id));
+                node.info->size = fp.prev.size = prev_size;
+                bp_tree_probe::find_leaf(*fixture.tree, node, fp.path, fp.leaf.min);
+                pairs.push_back(fp);
+            }
+            uint32_t blocks = manager->block_count();
+            std::vector<uint8_t> image(static_cast<size_t>(blocks) * BlockManager::block_size);
+            for (uint32_t id = 0; id < blocks; ++id) {
+                std::memcpy(&image[id * BlockManager::block_size], manager->open_block(id), BlockManager::block_size);
+            }
+            run("redistribute/" + strategy, [&] {
+                for (uint32_t id = 0; id < blocks; ++id) {
+                    std::memcpy(manager->open_block(id), &image[id * BlockManager::block_size],
+                                BlockManager::block_size);
+                }
+                return pairs.size();
+            }, [&](uint64_t i) {
+                const auto &fp = pairs[i];
+                bp_tree_probe::set_fast_path(*fixture.tree, fp);
+                node_t node;
+                node.load(manager->open_block(fp.leaf.id));
+                bp_tree_probe::redistribute(*fixture.tree, node, fp.leaf.max + 1);
+            });
+        }
+        fixture.tree.reset();
+    }
+
+#ifdef INMEMORY
+    void block_benchmarks() {
+        auto ids = random_keys(BLOCKS);
+        run("open_block/memory", [] { return UNLIMITED; },
+            [&](uint64_t i) { keep(manager->open_block(ids[i % QUERIES])); });
+    }
+#else
+    void block_benchmarks() {
+        constexpr uint32_t capacity = 1 << 10;
+        const char *file = "micro_bench_blocks.dat";
+        {
+            DiskBlockManager blocks(file, capacity);
+            for (uint32_t id = 0; id < 4 * capacity; ++id) {
+                blocks.allocate();
+                blocks.open_block(id);
+                blocks.mark_dirty(id);
+            }
+            blocks.flush();
+
+            auto hits = random_keys(capacity);
+            for (uint32_t id = 0; id < capacity; ++id) blocks.open_block(id);
+            run("open_block/hit", [] { return UNLIMITED; }, [&](uint64_t i) { keep(blocks.open_block(hits[i % QUERIES])); });
+            // cycling over more blocks than the buffer holds evicts the block that is needed next
+            run("open_block/miss", [] { return UNLIMITED; },
+                [&](uint64_t i) { keep(blocks.open_block(i % (4 * capacity))); });
+        }
+        std::remove(file);
+
+        LRUCache cache(capacity);
+        for (uint32_t id = 0; id < capacity; ++id) cache.get(id);
+        auto hits = random_keys(capacity);
+        run("lru_cache_get/hit", [] { return UNLIMITED; }, [&](uint64_t i) { keep(cache.get(hits[i % QUERIES])); });
+        run("lru_cache_get/miss", [] { return UNLIMITED; }, [&](uint64_t i) { keep(cache.get(i % (4 * capacity))); });
+    }
+#endif
+}
+
+int main(int argc, char **argv) {
+    if (argc > 1) filter = argv[1];
+
+    BlockManager blocks("micro_bench.dat", BLOCKS);
+    manager = &blocks;
+
+    std::cout << std::left << std::setw(44) << "Benchmark" << std::right << std::setw(15) << "Time" << std::setw(14)
+              << "Iterations" << std::endl;
+    node_benchmarks();
+    for (const char *strategy: STRATEGIES) {
+        dispatch_policy(strategy, [&](auto policy) { tree_benchmarks<decltype(policy)>(strategy); });
+    }
+    block_benchmarks();
+    return 0;
+}
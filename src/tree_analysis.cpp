@@ -1,37 +1,51 @@
 #include <chrono>
+#include <cstdlib>
+#include <cstring>
 #include <filesystem>
 #include <fstream>
+#include <optional>
 #include <random>
 #include <atomic>
+#include <thread>
 
 #include "bptree/config.h"
 #include "bptree/bp_tree.h"
+#include "bptree/latency_histogram.h"
+#include "bptree/sharded_tree.h"
+#include "bptree/spsc_queue.h"
+#include "bptree/workload_input.h"
 
 using key_type = unsigned;
 using value_type = unsigned;
+using input_t = workload_input<key_type>;
 
+// keys read from an input at a time
+constexpr size_t CHUNK = 1 << 12;
+// keys sampled to place the first shard boundaries
+constexpr size_t SHARD_SAMPLE = 1 << 12;
+
+/**
+ * Parse one unsigned decimal key per line; any other character ends a key
+ */
 std::vector<key_type> read_txt(const char *filename) {
     std::vector<key_type> data;
-    std::string line;
-    std::ifstream ifs(filename);
-    while (std::getline(ifs, line)) {
-        key_type key = std::stoul(line);
+    const mapped_file file(filename);
+    if (!file.valid()) return data;
+    const char *p = file.data();
+    const char *end = p + file.size();
+    // guess from the length of the first line to avoid most reallocations
+    const char *eol = static_cast<const char *>(memchr(p, '\n', file.size()));
+    data.reserve(file.size() / (eol ? eol - p + 1 : file.size()) + 1);
+    while (p < end) {
+        while (p < end && (*p < '0' || *p > '9')) ++p;
+        if (p == end) break;
+        key_type key = 0;
+        while (p < end && *p >= '0' && *p <= '9') key = key * 10 + (*p++ - '0');
         data.push_back(key);
     }
     return data;
 }
 
-std::vector<key_type> read_bin(const char *filename) {
-    std::ifstream inputFile(filename, std::ios::binary);
-    assert(inputFile.is_open());
-    inputFile.seekg(0, std::ios::end);
-    const std::streampos fileSize = inputFile.tellg();
-    inputFile.seekg(0, std::ios::beg);
-    std::vector<key_type> data(fileSize / sizeof(key_type));
-    inputFile.read(reinterpret_cast<char *>(data.data()), fileSize);
-    return data;
-}
-
 class Ticket {
     std::atomic<unsigned> _idx;
 //    unsigned _idx;
@@ -42,35 +56,331 @@ public:
         return idx < size ? idx : size;
     }
 
+    [[nodiscard]] size_t end() const { return size; }
+
+    /**
+     * Take up to max consecutive positions
+     * @return the first position and how many were taken, 0 when none are left
+     */
+    std::pair<size_t, size_t> take(size_t max) {
+        size_t first = _idx.fetch_add(max);
+        return {first, first < size ? std::min(max, size - first) : 0};
+    }
+
     Ticket(size_t first, size_t size) : _idx(first), size(size) {}
     explicit Ticket(size_t size) : _idx(0), size(size) {}
 };
 
-void insert_worker(bp_tree<key_type, value_type> &tree, const std::vector<key_type> &data, Ticket &line,
-                   const key_type &offset) {
-    auto idx = line.get();
-    const auto &size = data.size();
-    while (idx < size) {
-        const key_type &key = data[idx] + offset;
-        tree.insert(key, 0);
-        idx = line.get();
+/**
+ * Insert and, if lat is set, record the latency under the kind of work the insert did
+ * @return the kind of work, only told apart when lat is set
+ */
+template<typename tree_t>
+op_kind timed_insert(tree_t &tree, const key_type &key, const value_type &value, latency_report *lat) {
+    if (lat == nullptr) {
+        tree.insert(key, value);
+        return op_kind::INSERT_SLOW;
     }
+    const auto before = tree.trace();
+    const uint64_t start = latency::now();
+    tree.insert(key, value);
+    const uint64_t ticks = latency::now() - start;
+    const auto after = tree.trace();
+    op_kind kind;
+    if (after.nodes != before.nodes) {
+        kind = op_kind::SPLIT;
+    } else if (after.redistribute != before.redistribute) {
+        kind = op_kind::REDISTRIBUTE;
+    } else if (after.fast_path != before.fast_path) {
+        kind = op_kind::INSERT_FAST;
+    } else {
+        kind = op_kind::INSERT_SLOW;
+    }
+    lat->record(kind, ticks);
+    return kind;
 }
 
-void query_worker(bp_tree<key_type, value_type> &tree, const std::vector<key_type> &data, Ticket &line,
-                  const key_type &offset) {
-    unsigned idx = line.get();
-    const auto &size = data.size();
-    while (idx < size) {
-        const key_type &key = data[idx];
-        tree.contains(key + offset);
-        idx = line.get();
+template<typename tree_t>
+bool timed_contains(const tree_t &tree, const key_type &key, latency_report *lat) {
+    if (lat == nullptr) return tree.contains(key);
+    const uint64_t start = latency::now();
+    const bool res = tree.contains(key);
+    lat->record(op_kind::LOOKUP, latency::now() - start);
+    return res;
+}
+
+template<typename tree_t>
+size_t timed_top_k(const tree_t &tree, size_t k, const key_type &min_key, latency_report *lat) {
+    if (lat == nullptr) return tree.top_k(k, min_key);
+    const uint64_t start = latency::now();
+    const size_t loads = tree.top_k(k, min_key);
+    lat->record(op_kind::RANGE, latency::now() - start);
+    return loads;
+}
+
+/**
+ * Chooses the keys read by the mixed phase among the n keys inserted so far: uniformly, Zipfian with the popular keys
+ * scattered over the inserted ones, or Zipfian towards the most recently inserted keys
+ */
+class read_chooser {
+    enum {
+        UNIFORM, ZIPF, LATEST
+    } kind;
+    zipf_distribution zipf;
+
+public:
+    read_chooser(const std::string &distribution, double theta, size_t n) : kind(UNIFORM), zipf(n, theta) {
+        if (distribution == "zipf") {
+            kind = ZIPF;
+        } else if (distribution == "latest") {
+            kind = LATEST;
+        } else if (distribution != "uniform") {
+            std::cerr << "Invalid read distribution: " << distribution << std::endl;
+        }
+    }
+
+    template<typename rng_t>
+    key_type operator()(rng_t &rng, size_t n) {
+        if (kind == UNIFORM) return rng() % n;
+        // the popular keys only move when the domain is refreshed, once the inserted keys grow by an eighth
+        if (n > zipf.size() + zipf.size() / 8) zipf.resize(n);
+        const uint64_t rank = zipf(rng);
+        return kind == ZIPF ? scatter_rank(rank, zipf.size()) : n - rank;
+    }
+};
+
+/**
+ * Reads the keys of an input between two positions one at a time
+ */
+class key_cursor {
+    input_t &input;
+    size_t pos;
+    const size_t end;
+    std::vector<key_type> buf;
+    const key_type *chunk;
+    size_t chunk_pos;
+    size_t chunk_size;
+
+public:
+    key_cursor(input_t &input, size_t first, size_t end) :
+            input(input), pos(first), end(end), buf(CHUNK), chunk(nullptr), chunk_pos(0), chunk_size(0) {}
+
+    [[nodiscard]] size_t position() const { return pos; }
+
+    key_type next() {
+        assert(pos < end);
+        if (chunk_pos == chunk_size) {
+            chunk_size = std::min(CHUNK, end - pos);
+            chunk = input.read(pos, chunk_size, buf.data());
+            chunk_pos = 0;
+        }
+        ++pos;
+        return chunk[chunk_pos++];
+    }
+};
+
+template<typename tree_t>
+void insert_worker(tree_t &tree, input_t &input, Ticket &line, const key_type &offset, latency_report *lat,
+                   size_t compact_budget) {
+    std::vector<key_type> buf(CHUNK);
+    for (auto [pos, count] = line.take(CHUNK); count > 0; std::tie(pos, count) = line.take(CHUNK)) {
+        const key_type *keys = input.read(pos, count, buf.data());
+        for (size_t i = 0; i < count; ++i) {
+            timed_insert(tree, keys[i] + offset, 0, lat);
+        }
+        if (compact_budget > 0) tree.compact(compact_budget);
     }
 }
 
-void workload(bp_tree<key_type, value_type> &tree, const std::vector<key_type> &data, const Config &conf,
-              std::ofstream &results, const key_type &offset) {
-    const unsigned num_inserts = data.size();
+/**
+ * Insert through a pipeline: producer threads read runs of conf.pipeline_run keys, sort them and hand them to this
+ * thread, the only writer, over an SPSC queue per producer. Run r is read by producer r % producers and the runs are
+ * read and inserted in input order, so every execution builds the same tree.
+ */
+template<typename tree_t>
+void pipelined_insert(tree_t &tree, input_t &input, Ticket &line, const key_type &offset, latency_report *lat,
+                      const Config &conf, size_t compact_budget) {
+    // runs queued per producer; a producer cycles through QUEUE + 2 buffers, as the writer may still be inserting the
+    // run popped before the queued ones
+    constexpr size_t QUEUE = 4;
+    struct run {
+        key_type *keys;
+        size_t count;  // 0 once the input is exhausted
+    };
+    const size_t run_size = conf.pipeline_run;
+    const unsigned producers = std::max(1u, conf.pipeline_producers);
+    std::vector<std::unique_ptr<spsc_queue<run>>> queues;
+    for (unsigned p = 0; p < producers; ++p) queues.push_back(std::make_unique<spsc_queue<run>>(QUEUE));
+    // owned here rather than by the producers: a producer returns while the writer may still read its queued runs
+    std::vector<std::vector<std::vector<key_type>>> buffers(
+            producers, std::vector<std::vector<key_type>>(QUEUE + 2, std::vector<key_type>(run_size)));
+    // the run to read next; reads take turns so that generated inputs are read forward
+    std::atomic<size_t> turn{0};
+
+    auto produce = [&](unsigned p) {
+        for (size_t r = p, i = 0;; r += producers, ++i) {
+            key_type *buf = buffers[p][i % buffers[p].size()].data();
+            while (turn.load(std::memory_order_acquire) != r) std::this_thread::yield();
+            auto [pos, count] = line.take(run_size);
+            const key_type *keys = count > 0 ? input.read(pos, count, buf) : buf;
+            if (keys != buf) std::copy(keys, keys + count, buf);
+            turn.store(r + 1, std::memory_order_release);
+
+            for (size_t k = 0; k < count; ++k) buf[k] += offset;
+            std::sort(buf, buf + count);
+            while (!queues[p]->try_push({buf, count})) std::this_thread::yield();
+            if (count == 0) return;
+        }
+    };
+    std::vector<std::thread> threads;
+    for (unsigned p = 0; p < producers; ++p) threads.emplace_back(produce, p);
+
+    const std::vector<value_type> values(run_size);
+    for (size_t r = 0;; ++r) {
+        run next{};
+        while (!queues[r % producers]->try_pop(next)) std::this_thread::yield();
+        if (next.count == 0) break;
+        if (lat) {
+            for (size_t k = 0; k < next.count; ++k) timed_insert(tree, next.keys[k], 0, lat);
+        } else {
+            tree.insert_sorted(next.keys, values.data(), next.count);
+        }
+        if (compact_budget > 0) tree.compact(compact_budget);
+    }
+    for (auto &t: threads) t.join();
+}
+
+/**
+ * @param compact_budget leaves read by a compaction step after each chunk (or run) of keys, 0 for none
+ */
+template<typename tree_t>
+void load(tree_t &tree, input_t &input, Ticket &line, const key_type &offset, latency_report *lat,
+          const Config &conf, size_t compact_budget) {
+    if (conf.pipeline_run > 0) {
+        pipelined_insert(tree, input, line, offset, lat, conf, compact_budget);
+    } else {
+        insert_worker(tree, input, line, offset, lat, compact_budget);
+    }
+}
+
+/**
+ * Insert with up to workers threads, worker w owning the shards s with s % workers == w. Each round is routed once into
+ * one bucket per shard, and each worker inserts the buckets of its shards. The routes above the largest key are
+ * rebalanced between rounds; keys below it never move to another shard.
+ */
+template<typename K, typename V, typename P>
+void load(sharded_tree<K, V, P> &tree, input_t &input, Ticket &line, const key_type &offset, latency_report *lat,
+          const Config &conf, size_t compact_budget) {
+    constexpr size_t ROUND = CHUNK << 8;
+    const unsigned workers = std::clamp<unsigned>(conf.num_w_threads, 1, tree.size());
+    std::vector<key_type> buf(ROUND);
+    std::vector<std::vector<key_type>> buckets(tree.size());
+    std::vector<latency_report> reports(lat ? workers : 0);
+    auto work = [&](unsigned w) {
+        latency_report *report = lat ? &reports[w] : nullptr;
+        for (size_t s = w; s < buckets.size(); s += workers) {
+            for (const key_type &key: buckets[s]) timed_insert(tree.at(s), key, 0, report);
+        }
+    };
+    for (auto [pos, count] = line.take(ROUND); count > 0; std::tie(pos, count) = line.take(ROUND)) {
+        const key_type *keys = input.read(pos, count, buf.data());
+        for (auto &bucket: buckets) bucket.clear();
+        for (size_t i = 0; i < count; ++i) {
+            const key_type key = keys[i] + offset;
+            buckets[tree.shard_of(key)].push_back(key);
+        }
+        std::vector<std::thread> threads;
+        for (unsigned w = 1; w < workers; ++w) threads.emplace_back(work, w);
+        work(0);
+        for (auto &t: threads) t.join();
+        tree.rebalance();
+        // as many leaves per key as the single tree
+        if (compact_budget > 0) tree.compact(compact_budget * (ROUND / CHUNK));
+    }
+    for (const auto &report: reports) lat->merge(report);
+}
+
+template<typename tree_t>
+void query_worker(tree_t &tree, input_t &input, Ticket &line, const key_type &offset, latency_report *lat) {
+    std::vector<key_type> buf(CHUNK);
+    for (auto [pos, count] = line.take(CHUNK); count > 0; std::tie(pos, count) = line.take(CHUNK)) {
+        const key_type *keys = input.read(pos, count, buf.data());
+        // pinned once per chunk, the guards of the lookups nest without a fence
+        epoch::guard pin;
+        for (size_t i = 0; i < count; ++i) {
+            timed_contains(tree, keys[i] + offset, lat);
+        }
+    }
+}
+
+/**
+ * Check that the blocks a tree retires while a read is running stay out of the block manager until the read ends. A
+ * scan on another thread stops in its visitor, pinned, while this thread updates keys under a snapshot and runs a
+ * compaction step; releasing the snapshot retires the copies of the updated blocks, and the compaction the leaves it
+ * empties. A block manager without concurrent reads gets a pin on this thread in place of the scan.
+ * @param pool blocks the block manager of the tree keeps in memory, bounds the compaction step
+ * @return whether no retired block went back to the block manager before the scan ended
+ */
+template<typename K, typename V, typename P>
+bool check_reclamation(bp_tree<K, V, P> &tree, size_t pool) {
+    constexpr size_t UPDATES = 1024;
+    const size_t compact_step = std::min<size_t>(256, pool / 4);
+    const uint64_t size = tree.stats().size;
+    if (size == 0) return true;
+    // evenly spaced keys, only the ones updated are kept
+    std::vector<K> keys;
+    keys.reserve(UPDATES);
+    uint64_t seen = 0;
+    tree.scan(std::numeric_limits<K>::lowest(), [&](const K &key, const V &) {
+        if (seen++ == keys.size() * size / UPDATES) keys.push_back(key);
+        return keys.size() < UPDATES;
+    });
+    tree.reclaim_all();
+
+    std::atomic<int> stage{0};  // 1 once the scan is pinned, 2 to let it end
+    std::thread reader;
+    std::optional<epoch::guard> pin;
+    if constexpr (BlockManager::concurrent_reads) {
+        reader = std::thread([&] {
+            tree.scan(std::numeric_limits<K>::lowest(), [&](const K &, const V &) {
+                stage.store(1, std::memory_order_release);
+                while (stage.load(std::memory_order_acquire) != 2) std::this_thread::yield();
+                return false;
+            });
+        });
+        while (stage.load(std::memory_order_acquire) != 1) std::this_thread::yield();
+    } else {
+        pin.emplace();
+    }
+    const uint64_t leaves = tree.stats().leaves;
+    size_t copies;
+    {
+        auto view = tree.snapshot();
+        for (const K &key: keys) tree.insert(key, *tree.get(key));
+        tree.compact(compact_step);
+        copies = view.copies();
+    }
+    const bool held = tree.deferred() == copies + (leaves - tree.stats().leaves);
+    stage.store(2, std::memory_order_release);
+    if (reader.joinable()) reader.join();
+    pin.reset();
+    tree.reclaim_all();
+    return held && tree.deferred() == 0;
+}
+
+template<typename K, typename V, typename P>
+bool check_reclamation(sharded_tree<K, V, P> &tree, size_t pool) {
+    // the shards split the buffer pool evenly
+    const size_t shard_pool = std::max<size_t>(pool / tree.size(), 1);
+    bool good = true;
+    for (size_t s = 0; s < tree.size(); ++s) good &= check_reclamation(tree.at(s), shard_pool);
+    return good;
+}
+
+template<typename tree_t>
+void workload(tree_t &tree, input_t &input, const Config &conf,
+              std::ostream &results, std::ofstream &latencies, const key_type &offset) {
+    const unsigned num_inserts = input.size();
     const unsigned raw_queries = conf.raw_read_perc / 100.0 * num_inserts;
     const unsigned raw_writes = conf.raw_write_perc / 100.0 * num_inserts;
     const unsigned mixed_size = conf.mix_load_perc / 100.0 * num_inserts;
@@ -93,14 +403,42 @@ void workload(bp_tree<key_type, value_type> &tree, const std::vector<key_type> &
     unsigned mix_queries = 0;
     uint32_t ctr_empty = 0;
 
+    // per-op latencies are only captured when a LATENCY_FILE is configured
+    latency_report report;
+    latency_report *lat = latencies.is_open() ? &report : nullptr;
+    const char *phase_sep = "";
+    auto write_phase = [&](const char *phase, latency_report &phase_report) {
+        if (lat == nullptr) return;
+        latencies << phase_sep << '"' << phase << "\": ";
+        phase_report.write_json(latencies);
+        phase_report.reset();
+        phase_sep = ", ";
+    };
+    auto end_phase = [&](const char *phase) { write_phase(phase, report); };
+
     results << ", ";
     if (num_load > 0) {
         Ticket line(num_load);
         std::cerr << "Preloading (" << num_load << "/" << num_inserts << ")\n";
         auto start = std::chrono::high_resolution_clock::now();
-        insert_worker(tree, data, line, offset);
+        load(tree, input, line, offset, lat, conf, 0);
         auto duration = std::chrono::high_resolution_clock::now() - start;
         results << duration.count();
+        end_phase("preload");
+    }
+
+    if (num_load > 0 && conf.compact_budget > 0) {
+        // one full pass over the leaves, then steps during the later inserts
+        auto print_fill = [](const char *when, const auto &f) {
+            std::cerr << "Leaf fill " << when << " compaction: " << f.fill * 100 << "% over " << f.leaves
+                      << " leaves, " << f.underfull << " at most half full\n";
+        };
+        print_fill("before", tree.fill());
+        auto start = std::chrono::high_resolution_clock::now();
+        while (!tree.compact(conf.compact_budget)) {}
+        std::chrono::nanoseconds spent = std::chrono::high_resolution_clock::now() - start;
+        print_fill("after", tree.fill());
+        std::cerr << "Compaction took " << spent.count() / 1000000 << " ms\n";
     }
 
     results << ", ";
@@ -108,34 +446,109 @@ void workload(bp_tree<key_type, value_type> &tree, const std::vector<key_type> &
         Ticket line(num_load, num_load + raw_writes);
         std::cerr << "Raw write (" << raw_writes << "/" << num_inserts << ")\n";
         auto start = std::chrono::high_resolution_clock::now();
-        insert_worker(tree, data, line, offset);
+        load(tree, input, line, offset, lat, conf, conf.compact_budget);
         auto duration = std::chrono::high_resolution_clock::now() - start;
         results << duration.count();
+        end_phase("raw_write");
     }
 
     results << ", ";
     if (mixed_size > 0) {
-        Ticket line(num_load + raw_writes, num_load + raw_writes + mixed_size);
+        key_cursor keys(input, num_load + raw_writes, num_load + raw_writes + mixed_size);
         std::cerr << "Mixed load (2*" << mixed_size << "/" << num_inserts << ")\n";
         auto start = std::chrono::high_resolution_clock::now();
-        while (mix_inserts < mixed_size || mix_queries < mixed_reads) {
-            auto idx = line.get();
-            if (mix_queries >= mixed_reads || (mix_inserts < mixed_size && distribution(generator))) {
-                const key_type &key = data[idx] + offset;
-                tree.insert(key, idx++);
+        const uint64_t start_ticks = latency::now();
+        // queries pick among the keys inserted so far
+        auto idx = keys.position();
+        read_chooser chooser(conf.mixed_read_distribution, conf.mixed_zipf_theta, idx);
+        std::uniform_int_distribution<unsigned> percent(0, 99);
+        // range scans see the tree as it was at the start of the phase
+        std::optional<typename tree_t::snapshot_view> scan_view;
+        if (conf.snapshot_scans) scan_view.emplace(tree.snapshot());
+        const metrics::snapshot before = metrics::collect();
+        auto mixed_read = [&]() {
+            key_type query_index = chooser(generator, idx) + offset;
+            if (conf.mixed_range_perc > 0 && percent(generator) < conf.mixed_range_perc) {
+                if (scan_view) {
+                    timed_top_k(*scan_view, conf.mixed_range_size, query_index, lat);
+                } else {
+                    timed_top_k(tree, conf.mixed_range_size, query_index, lat);
+                }
+                return op_kind::RANGE;
+            }
 
-                mix_inserts++;
-            } else {
-                key_type query_index = generator() % idx + offset;
+            const bool res = timed_contains(tree, query_index, lat);
 
-                const bool res = tree.contains(query_index);
+            ctr_empty += !res;
+            return op_kind::LOOKUP;
+        };
+        latency_report response;
+        if (conf.mixed_qps > 0) {
+            /*
+             * Open loop: operations arrive as a Poisson process at MIXED_QPS whether or not the tree keeps up, and
+             * the response time of each one is measured from its scheduled arrival. A slow operation then also
+             * delays the ones queued behind it, which a closed loop would omit from its latencies.
+             */
+            std::exponential_distribution<double> arrival(conf.mixed_qps * latency::ns_per_tick() / 1e9);
+            double scheduled = latency::now();
+            while (mix_inserts < mixed_size || mix_queries < mixed_reads) {
+                scheduled += arrival(generator);
+                const auto arrival_time = static_cast<uint64_t>(scheduled);
+                // spin, arrivals are too close for the scheduler to sleep between them
+                while (latency::now() < arrival_time) {}
 
-                ctr_empty += !res;
-                mix_queries++;
+                // keep the read-write ratio over the remaining operations
+                const unsigned left_inserts = mixed_size - mix_inserts;
+                const unsigned left_queries = mixed_reads - mix_queries;
+                op_kind kind;
+                if (std::uniform_int_distribution<unsigned>(1, left_inserts + left_queries)(generator) <= left_inserts) {
+                    kind = timed_insert(tree, keys.next() + offset, idx, lat);
+                    idx = keys.position();
+                    mix_inserts++;
+                    if (conf.compact_budget > 0 && mix_inserts % CHUNK == 0) tree.compact(conf.compact_budget);
+                } else {
+                    kind = mixed_read();
+                    mix_queries++;
+                }
+                if (lat) response.record(kind, latency::now() - arrival_time);
             }
+            const double seconds = (latency::now() - start_ticks) * latency::ns_per_tick() / 1e9;
+            std::cerr << "Open loop at " << conf.mixed_qps << " QPS, achieved "
+                      << static_cast<uint64_t>((mix_inserts + mix_queries) / seconds) << " QPS\n";
+        } else {
+            while (mix_inserts < mixed_size || mix_queries < mixed_reads) {
+                if (mix_queries >= mixed_reads || (mix_inserts < mixed_size && distribution(generator))) {
+                    const key_type key = keys.next() + offset;
+                    timed_insert(tree, key, idx, lat);
+                    idx = keys.position();
+
+                    mix_inserts++;
+                    if (conf.compact_budget > 0 && mix_inserts % CHUNK == 0) tree.compact(conf.compact_budget);
+                } else {
+                    mixed_read();
+                    mix_queries++;
+                }
+            }
+        }
+        if (scan_view) std::cerr << "Snapshot copied " << scan_view->copies() << " blocks\n";
+        const metrics::snapshot after = metrics::collect();
+        if (conf.leaf_filters) {
+            std::cerr << "Leaf filters answered " << after[metrics::event::FILTERED] - before[metrics::event::FILTERED]
+                      << " of " << ctr_empty << " empty lookups\n";
+        }
+        if (after[metrics::event::FAST_READ] > before[metrics::event::FAST_READ]) {
+            std::cerr << "Fast path served " << after[metrics::event::FAST_READ] - before[metrics::event::FAST_READ]
+                      << " reads\n";
         }
+        if (conf.lookup_cache > 0) {
+            std::cerr << "Lookup cache skipped " << after[metrics::event::CACHED] - before[metrics::event::CACHED]
+                      << " descents\n";
+        }
+        scan_view.reset();
         auto duration = std::chrono::high_resolution_clock::now() - start;
         results << duration.count();
+        end_phase("mixed");
+        if (conf.mixed_qps > 0) write_phase("mixed_response", response);
     }
 
     results << ", ";
@@ -143,11 +556,12 @@ void workload(bp_tree<key_type, value_type> &tree, const std::vector<key_type> &
         std::cerr << "Raw read (" << raw_queries << "/" << num_inserts << ")\n";
         auto start = std::chrono::high_resolution_clock::now();
         for (unsigned i = 0; i < raw_queries; i++) {
-            key_type key = data[range_distribution(generator) % data.size()] + offset;
-            tree.contains(key);
+            key_type key = input.pick(range_distribution(generator)) + offset;
+            timed_contains(tree, key, lat);
         }
         auto duration = std::chrono::high_resolution_clock::now() - start;
         results << duration.count();
+        end_phase("raw_read");
     }
 
     results << ", ";
@@ -155,25 +569,27 @@ void workload(bp_tree<key_type, value_type> &tree, const std::vector<key_type> &
         std::cerr << "Updates (" << updates << "/" << num_inserts << ")\n";
         auto start = std::chrono::high_resolution_clock::now();
         for (unsigned i = 0; i < updates; i++) {
-            tree.insert(data[range_distribution(generator) % data.size()] + offset, 0);
+            timed_insert(tree, input.pick(range_distribution(generator)) + offset, 0, lat);
         }
         auto duration = std::chrono::high_resolution_clock::now() - start;
         results << duration.count();
+        end_phase("updates");
     }
 
     results << ", ";
     if (conf.short_range > 0) {
         size_t leaf_accesses = 0;
-        size_t k = data.size() / 1000;
+        size_t k = input.size() / 1000;
         std::cerr << "Range " << k << " (" << conf.short_range << ")\n";
         auto start = std::chrono::high_resolution_clock::now();
         for (unsigned i = 0; i < conf.short_range; i++) {
-            const key_type min_key = data[range_distribution(generator) % (data.size() - k)] + offset;
-            leaf_accesses += tree.top_k(k, min_key);
+            const key_type min_key = input.pick(range_distribution(generator), k) + offset;
+            leaf_accesses += timed_top_k(tree, k, min_key, lat);
         }
         auto duration = std::chrono::high_resolution_clock::now() - start;
         auto avg = (leaf_accesses - 1 + conf.short_range) / conf.short_range;  // ceil
         results << duration.count() << ", " << avg;
+        end_phase("short_range");
     } else {
         results << ", ";
     }
@@ -181,16 +597,17 @@ void workload(bp_tree<key_type, value_type> &tree, const std::vector<key_type> &
     results << ", ";
     if (conf.mid_range > 0) {
         size_t leaf_accesses = 0;
-        size_t k = data.size() / 100;
+        size_t k = input.size() / 100;
         std::cerr << "Range " << k << " (" << conf.mid_range << ")\n";
         auto start = std::chrono::high_resolution_clock::now();
         for (unsigned i = 0; i < conf.mid_range; i++) {
-            const key_type min_key = data[range_distribution(generator) % (data.size() - k)] + offset;
-            leaf_accesses += tree.top_k(k, min_key);
+            const key_type min_key = input.pick(range_distribution(generator), k) + offset;
+            leaf_accesses += timed_top_k(tree, k, min_key, lat);
         }
         auto duration = std::chrono::high_resolution_clock::now() - start;
         auto avg = (leaf_accesses - 1 + conf.mid_range) / conf.mid_range;  // ceil
         results << duration.count() << ", " << avg;
+        end_phase("mid_range");
     } else {
         results << ", ";
     }
@@ -198,29 +615,67 @@ void workload(bp_tree<key_type, value_type> &tree, const std::vector<key_type> &
     results << ", ";
     if (conf.long_range > 0) {
         size_t leaf_accesses = 0;
-        size_t k = data.size() / 10;
+        size_t k = input.size() / 10;
         std::cerr << "Range " << k << " (" << conf.long_range << ")\n";
         auto start = std::chrono::high_resolution_clock::now();
         for (unsigned i = 0; i < conf.long_range; i++) {
-            const key_type min_key = data[range_distribution(generator) % (data.size() - k)] + offset;
-            leaf_accesses += tree.top_k(k, min_key);
+            const key_type min_key = input.pick(range_distribution(generator), k) + offset;
+            leaf_accesses += timed_top_k(tree, k, min_key, lat);
         }
         auto duration = std::chrono::high_resolution_clock::now() - start;
         auto avg = (leaf_accesses - 1 + conf.long_range) / conf.long_range;  // ceil
         results << duration.count() << ", " << avg;
+        end_phase("long_range");
     } else {
         results << ", ";
     }
 
+    if (conf.aggregate_scans > 0) {
+        // reported apart, the results file keeps its columns
+        std::cerr << "Aggregate (" << conf.aggregate_scans << ", " << conf.aggregate_threads << " threads)\n";
+        size_t leaf_accesses = 0;
+        unsigned wrong = 0;
+        std::chrono::nanoseconds spent{0};
+        for (unsigned i = 0; i < conf.aggregate_scans; i++) {
+            key_type lo = input.pick(range_distribution(generator)) + offset;
+            key_type hi = input.pick(range_distribution(generator)) + offset;
+            if (hi < lo) std::swap(lo, hi);
+            auto start = std::chrono::high_resolution_clock::now();
+            const auto agg = tree.aggregate(lo, hi, conf.aggregate_threads);
+            spent += std::chrono::high_resolution_clock::now() - start;
+            leaf_accesses += agg.loads;
+            if (conf.validate) {
+                uint64_t count = 0;
+                uint64_t sum = 0;
+                tree.scan(lo, [&](const key_type &key, const value_type &value) {
+                    if (!(key < hi)) return false;
+                    ++count;
+                    sum += value;
+                    return true;
+                });
+                wrong += count != agg.count || sum != agg.sum;
+            }
+        }
+        std::cerr << "Aggregate took " << spent.count() / conf.aggregate_scans << " ns and "
+                  << leaf_accesses / conf.aggregate_scans << " leaves per scan\n";
+        if (wrong) std::cerr << "Error: " << wrong << " aggregates differ from a scan\n";
+    }
+
     results << ", " << ctr_empty << ", " << tree << "\n";
+    if (lat) latencies << "}}\n";
 
     if (conf.validate) {
         unsigned count = 0;
-        for (const auto &item: data) {
-            if (!tree.contains(item)) {
-                // std::cerr << item << " not found" << std::endl;
-                // break;
-                count++;
+        std::vector<key_type> buf(CHUNK);
+        for (size_t pos = 0; pos < input.size(); pos += CHUNK) {
+            size_t n = std::min(CHUNK, input.size() - pos);
+            const key_type *keys = input.read(pos, n, buf.data());
+            for (size_t i = 0; i < n; ++i) {
+                if (!tree.contains(keys[i] + offset)) {
+                    // std::cerr << keys[i] << " not found" << std::endl;
+                    // break;
+                    count++;
+                }
             }
         }
         if (count) {
@@ -241,64 +696,100 @@ int main(int argc, char **argv) {
     auto tree_dat = "tree.dat";
 
     Config conf(config_file);
-    BlockManager manager(tree_dat, conf.blocks_in_memory);
+    arena_config arena;
+    arena.huge_pages = conf.huge_pages;
+    arena.numa = conf.numa;
+    // each shard makes its own
+    std::optional<BlockManager> manager;
+    if (conf.shards <= 1) manager.emplace(tree_dat, conf.blocks_in_memory, arena, conf.compress_blocks);
 
     auto results_csv = conf.results_csv;
-    std::cerr << "Writing results to: " << results_csv << std::endl;
+    if (const char *env = std::getenv("RESULTS_FILE")) results_csv = env;
+    std::cerr << "Writing results to: " << (results_csv == "-" ? "stdout" : results_csv) << std::endl;
 
-    std::vector<std::vector<key_type>> data;
+    std::vector<std::unique_ptr<input_t>> inputs;
     for (int i = 1; i < argc; i++) {
+        if (auto generator = make_key_generator<key_type>(argv[i], conf.seed)) {
+            std::cerr << "Generating " << argv[i] << std::endl;
+            inputs.emplace_back(std::make_unique<generated_input<key_type>>(argv[i], std::move(generator), conf.seed));
+            continue;
+        }
         std::cerr << "Reading " << argv[i] << std::endl;
         if (conf.binary_input) {
-            data.emplace_back(read_bin(argv[i]));
+            auto input = std::make_unique<mmap_input<key_type>>(argv[i]);
+            if (!input->valid()) {
+                std::cerr << "Cannot map " << argv[i] << std::endl;
+                return 1;
+            }
+            inputs.emplace_back(std::move(input));
         } else {
-            data.emplace_back(read_txt(argv[i]));
+            inputs.emplace_back(std::make_unique<vector_input<key_type>>(argv[i], read_txt(argv[i])));
         }
     }
-    std::ofstream results(results_csv, std::ofstream::app);
-
-    const char *name =
-#ifndef FAST_PATH
-            "SIMPLE"
-#else
-#ifdef QUIT_FAT
-    "QUIT"
-#else
-#ifdef TAIL_FAT
-    "TAIL"
-#else
-#ifdef LIL_FAT
-    "LIL"
-#else
-#ifdef LOL_FAT
-    "LOL"
-#ifdef REDISTRIBUTE
-    "_REDISTRIBUTE"
-#endif
-#ifdef VARIABLE_SPLIT
-    "_VARIABLE"
-#endif
-#ifdef LOL_RESET
-    "_RESET"
-#endif
-#endif
-#endif
-#endif
-#endif
-#endif
-    ;
+    std::ofstream results_file;
+    if (results_csv != "-") results_file.open(results_csv, std::ofstream::app);
+    std::ostream &results = results_csv == "-" ? std::cout : results_file;
+    std::ofstream latencies;
+    if (!conf.latency_file.empty()) {
+        std::cerr << "Writing latencies to: " << conf.latency_file << std::endl;
+        latencies.open(conf.latency_file, std::ofstream::app);
+    }
+
+    outlier_config outliers;
+    outliers.type = conf.outlier_detector;
+    outliers.quantile = conf.outlier_quantile;
+    outliers.slack = conf.outlier_slack;
+    outliers.split_margin = conf.outlier_split_margin;
+    outliers.window_leaves = conf.outlier_window;
 
     for (unsigned i = 0; i < conf.runs; ++i) {
-        manager.reset();
-        bp_tree<key_type, value_type> tree(manager);
-        key_type offset = 0;
-        for (unsigned j = 0; j < conf.repeat; ++j) {
-            for (unsigned k = 0; k < data.size(); ++k) {
-                const auto &input = data[k];
-                results << name << ", " << argv[k + 1] << ", " << offset;
-                workload(tree, input, conf, results, offset);
-                results.flush();
-                offset += input.size();
+        for (const auto &tree_name: conf.trees) {
+            bool found = dispatch_policy(tree_name, [&](auto policy) {
+                using policy_t = decltype(policy);
+                std::cerr << "Tree: " << policy_t::name << std::endl;
+                if (manager) manager->reset();
+                metrics::reset();
+                auto run = [&](auto &tree) {
+                    tree.learned_routing(conf.learned_routing);
+                    tree.leaf_filters(conf.leaf_filters);
+                    tree.cache_lookups(conf.lookup_cache);
+                    key_type offset = 0;
+                    for (unsigned j = 0; j < conf.repeat; ++j) {
+                        for (const auto &input: inputs) {
+                            results << policy_t::name << ", " << input->name() << ", " << offset;
+                            if (latencies.is_open()) {
+                                latencies << "{\"tree\": \"" << policy_t::name << "\", \"input\": \""
+                                          << input->name() << "\", \"offset\": " << offset << ", \"phases\": {";
+                            }
+                            workload(tree, *input, conf, results, latencies, offset);
+                            results.flush();
+                            latencies.flush();
+                            offset += input->size();
+                        }
+                    }
+                    if (conf.check_reclamation && !check_reclamation(tree, conf.blocks_in_memory)) {
+                        std::cerr << "Error: a block was recycled under a running read" << std::endl;
+                    }
+                };
+                if (conf.shards > 1) {
+                    // the first routes split a sample of the first input evenly
+                    inputs[0]->fill_sample();
+                    std::mt19937 rng(conf.seed);
+                    std::vector<key_type> sample(SHARD_SAMPLE);
+                    for (auto &key: sample) key = inputs[0]->pick(rng());
+                    sharded_tree<key_type, value_type, policy_t> tree(tree_dat, conf.blocks_in_memory, conf.shards,
+                                                                      std::move(sample), arena,
+                                                                      conf.compress_blocks, outliers);
+                    run(tree);
+                    std::cerr << "Shards: " << tree.size() << ", rebalances: " << tree.rebalances() << ", routes: "
+                              << tree.route_count() << std::endl;
+                } else {
+                    bp_tree<key_type, value_type, policy_t> tree(*manager, outliers);
+                    run(tree);
+                }
+            });
+            if (!found) {
+                std::cerr << "Invalid tree name: " << tree_name << std::endl;
             }
         }
     }